@@ -0,0 +1,139 @@
+#include "cap_first_letter.hpp"
+#include <cctype>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define CAP_SIMD
+#include <immintrin.h>
+#endif
+
+bool cap_first_letter_scalar(char *str, size_t size, bool is_prev_space)
+{
+	for(size_t i = 0; i < size; i++)
+	{
+		if(isspace(str[i]))
+		{
+			// no need to mutate any space characters
+			is_prev_space = true;
+			continue;
+		}
+
+		if(is_prev_space)
+		{
+			// previous character was a space but the current one isn't, so turn the current character to upper case
+			str[i] = toupper(str[i]);
+		}
+		else
+		{
+			str[i] = tolower(str[i]);
+		}
+
+		is_prev_space = false;
+	}
+
+	return is_prev_space;
+}
+
+#ifdef CAP_SIMD
+
+/*
+	both kernels do str[1..size) and leave a tail of less than one block for the caller;
+	str[0] must be done already. A byte is a word start if the byte before it is a space;
+	the bytes before come from an unaligned load at one byte back, which is safe because
+	changing case never changes whether a byte is a space. Returns the number of bytes done.
+*/
+
+static size_t cap_sse2(char *str, size_t size)
+{
+	const __m128i tab_minus_1 = _mm_set1_epi8('\t' - 1);
+	const __m128i cr_plus_1 = _mm_set1_epi8('\r' + 1);
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i upper_a = _mm_set1_epi8('A' - 1), upper_z = _mm_set1_epi8('Z' + 1);
+	const __m128i lower_a = _mm_set1_epi8('a' - 1), lower_z = _mm_set1_epi8('z' + 1);
+	const __m128i case_bit = _mm_set1_epi8(0x20);
+	size_t i = 1;
+
+	for(; i + 16 <= size; i += 16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + i));
+		__m128i prev = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + i - 1));
+
+		if(_mm_movemask_epi8(v) != 0)
+		{
+			// non-ASCII; locale rules apply
+			cap_first_letter_scalar(str + i, 16, isspace(str[i - 1]));
+			continue;
+		}
+
+		// '\t'..'\r' or ' ' (a non-ASCII prev is negative, so never a space)
+		__m128i prev_space = _mm_or_si128(_mm_and_si128(_mm_cmpgt_epi8(prev, tab_minus_1), _mm_cmplt_epi8(prev, cr_plus_1)),
+		                                  _mm_cmpeq_epi8(prev, space));
+		__m128i is_upper = _mm_and_si128(_mm_cmpgt_epi8(v, upper_a), _mm_cmplt_epi8(v, upper_z));
+		__m128i is_lower = _mm_and_si128(_mm_cmpgt_epi8(v, lower_a), _mm_cmplt_epi8(v, lower_z));
+		// lower case at a word start, or upper case anywhere else
+		__m128i flip = _mm_or_si128(_mm_and_si128(prev_space, is_lower), _mm_andnot_si128(prev_space, is_upper));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(str + i), _mm_xor_si128(v, _mm_and_si128(flip, case_bit)));
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t cap_avx2(char *str, size_t size)
+{
+	const __m256i tab_minus_1 = _mm256_set1_epi8('\t' - 1);
+	const __m256i cr_plus_1 = _mm256_set1_epi8('\r' + 1);
+	const __m256i space = _mm256_set1_epi8(' ');
+	const __m256i upper_a = _mm256_set1_epi8('A' - 1), upper_z = _mm256_set1_epi8('Z' + 1);
+	const __m256i lower_a = _mm256_set1_epi8('a' - 1), lower_z = _mm256_set1_epi8('z' + 1);
+	const __m256i case_bit = _mm256_set1_epi8(0x20);
+	size_t i = 1;
+
+	for(; i + 32 <= size; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(str + i));
+		__m256i prev = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(str + i - 1));
+
+		if(_mm256_movemask_epi8(v) != 0)
+		{
+			// non-ASCII; locale rules apply
+			cap_first_letter_scalar(str + i, 32, isspace(str[i - 1]));
+			continue;
+		}
+
+		// '\t'..'\r' or ' ' (a non-ASCII prev is negative, so never a space)
+		__m256i prev_space = _mm256_or_si256(_mm256_and_si256(_mm256_cmpgt_epi8(prev, tab_minus_1),
+		                                     _mm256_cmpgt_epi8(cr_plus_1, prev)), _mm256_cmpeq_epi8(prev, space));
+		__m256i is_upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, upper_a), _mm256_cmpgt_epi8(upper_z, v));
+		__m256i is_lower = _mm256_and_si256(_mm256_cmpgt_epi8(v, lower_a), _mm256_cmpgt_epi8(lower_z, v));
+		// lower case at a word start, or upper case anywhere else
+		__m256i flip = _mm256_or_si256(_mm256_and_si256(prev_space, is_lower), _mm256_andnot_si256(prev_space, is_upper));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(str + i), _mm256_xor_si256(v, _mm256_and_si256(flip, case_bit)));
+	}
+
+	return i;
+}
+
+#endif
+
+bool cap_first_letter(char *str, size_t size, bool is_prev_space)
+{
+#ifdef CAP_SIMD
+	// not worth it for short strings
+	if(size > 32)
+	{
+		static const bool has_avx2 = __builtin_cpu_supports("avx2");
+		cap_first_letter_scalar(str, 1, is_prev_space);
+		size_t done = has_avx2 ? cap_avx2(str, size) : cap_sse2(str, size);
+		return cap_first_letter_scalar(str + done, size - done, isspace(str[done - 1]));
+	}
+#endif
+	return cap_first_letter_scalar(str, size, is_prev_space);
+}
+
+void cap_first_letter(std::string &str)
+{
+	if(!str.empty())
+	{
+		cap_first_letter(&str[0], str.size(), true);
+	}
+}
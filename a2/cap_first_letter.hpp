@@ -0,0 +1,22 @@
+#ifndef _cap_first_letter_hpp_
+#define _cap_first_letter_hpp_
+
+#include <cstddef>
+#include <string>
+
+/*
+	the server's transform: the first letter of every word goes to upper case, the rest to lower case
+		- isspace() separates words; toupper()/tolower() do the conversion (C locale)
+		- ASCII is done 16 (SSE2) or 32 (AVX2) bytes at a time; blocks with other bytes go
+				through the scalar loop, so the result is the same as the scalar loop's
+*/
+void cap_first_letter(std::string &str);
+
+// for strings that come in pieces: is_prev_space tells whether the byte before str was a space
+// (true at the start of a string); returns the same for the byte after str
+bool cap_first_letter(char *str, size_t size, bool is_prev_space);
+
+// the plain loop, for testing
+bool cap_first_letter_scalar(char *str, size_t size, bool is_prev_space);
+
+#endif
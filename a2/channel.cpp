@@ -2,17 +2,22 @@
 #include "sockets.hpp"
 #include <arpa/inet.h>
 #include <cassert>
+#include <cstring>
 #include <exception>
 #include <limits>
+#include <sys/eventfd.h>
 #include <unistd.h>
 
 namespace TCP
 {
 
 StringChannel::StringChannel(Sockets &socket_ref)
-	: socket_ref(socket_ref), closing(false), num_pending(0)
+	: socket_ref(socket_ref), is_wake_pending(false), closing(false), num_pending(0), stream_size(0)
 {
-	if(pthread_mutex_init(&lock, NULL) != 0)
+	memset(this->has_64bit, 0, sizeof(this->has_64bit));
+	this->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if(this->wake_fd < 0)
 	{
 		// should not happen in the student environment
 		assert(false);
@@ -22,151 +27,386 @@ StringChannel::StringChannel(Sockets &socket_ref)
 
 StringChannel::~StringChannel()
 {
-	pthread_mutex_destroy(&this->lock);
+	::close(this->wake_fd);
 }
 
 int StringChannel::receive_any(std::pair<int,std::string> &ret)
 {
-	int retval;
-	pthread_mutex_lock(&this->lock);
-	retval = receive_any_helper(ret);
-	pthread_mutex_unlock(&this->lock);
+	Piece piece;
+	// without streaming, every piece is a whole string
+	assert(this->stream_size == 0);
 
-	if(retval >= 0)
+	if(!this->inbound.pop(piece))
 	{
-		// reduce the number of pending request count by 1
-		this->num_pending--;
-		assert(retval >= 0);
+		// nothing has come in since the last sync()
+		return -1;
 	}
 
-	return retval;
+	assert(piece.is_first && piece.is_last);
+	ret.first = piece.fd;
+	ret.second.swap(piece.data);
+	// reduce the number of pending request count by 1
+	__atomic_sub_fetch(&this->num_pending, 1, __ATOMIC_SEQ_CST);
+	return 0;
+}
+
+int StringChannel::receive_piece(Piece &ret)
+{
+	return this->inbound.pop(ret) ? 0 : -1;
+}
+
+void StringChannel::set_stream_size(size_t size)
+{
+	this->stream_size = size;
 }
 
-int StringChannel::receive_any_helper(std::pair<int,std::string> &ret)
+int StringChannel::parse_piece(Piece &ret)
 {
 	std::pair<int,Sockets::Message*> raw_request;
 
 	if(this->socket_ref.get_available_msg(raw_request) < 0)
 	{
-		// no request is ready yet (still buffering)
+		// no connection has bytes that haven't been looked at
 		return -1;
 	}
 
 	StringRequest &request = this->requests[raw_request.first];
 	Sockets::Message &msg = *raw_request.second;
 
-	if(request.data.empty())
+	if(!request.has_size)
 	{
-		// this is a new request
+		// this is a new request; its size can arrive in pieces
+		// (sync() queues the fd again when more bytes come in)
+		if(msg.size() < 4)
+		{
+			return 1;
+		}
+
+		unsigned char header[12];
+		msg.peek(header, 4);
 		// nsize in network order
-		unsigned int nsize = msg.front() << 24;
-		msg.pop_front();
-		nsize += msg.front() << 16;
-		msg.pop_front();
-		nsize += msg.front() << 8;
-		msg.pop_front();
-		nsize += msg.front();
-		msg.pop_front();
-		// request.size in host order
-		request.size = ntohl(nsize);
-	}
-
-	// msg must have at least 1 byte to read (i.e. '\0')
-	assert(!msg.empty());
-	// the request isn't new -- fill up data up to request.size - 1
-	// notice we're working on std::string, not a c-string
-	size_t size = request.size - 1;
+		unsigned int nsize = (header[0] << 24) + (header[1] << 16) + (header[2] << 8) + header[3];
 
-	while(!msg.empty())
-	{
-		if(request.data.size() == size)
+		if(nsize != 0)
+		{
+			msg.pop(header, 4);
+			// request.size in host order
+			request.size = ntohl(nsize);
+		}
+		else
 		{
-#ifndef NDEBUG
-			// the next character must be the null terminator
-			assert(!msg.empty());
-			unsigned char null_char = msg.front();
-			assert(null_char == '\0');
-#endif
-			// get rid of the null-terminator
-			msg.pop_front();
-			// assign return value (by copy)
-			ret.first = raw_request.first;
-			ret.second = request.data;
-			// clear the current buffer for new requests
-			int num_erased = requests.erase(raw_request.first);
-			// suppress warning
-			(void) num_erased;
-			assert(num_erased == 1);
-
-			if(msg.empty())
+			// 64-bit frame
+			if(msg.size() < sizeof(header))
+			{
+				return 1;
+			}
+
+			msg.pop(header, sizeof(header));
+			request.size = 0;
+
+			for(size_t i = 4; i < sizeof(header); i++)
 			{
-				// calling clear() seems to deallocate memory (tested on gcc 4.6.4)
-				// note: msg allocates memory dynamically, so need to shrink memory
-				// when available to prevent internal memory fragmentation
-				msg.clear();
+				request.size = (request.size << 8) | header[i];
 			}
 
-			return 0;
+			__atomic_store_n(&this->has_64bit[raw_request.first], true, __ATOMIC_RELEASE);
 		}
 
-		request.data.push_back(msg.front());
-		msg.pop_front();
+		request.has_size = true;
+		request.is_streamed = this->stream_size > 0 && request.size > this->stream_size;
 	}
 
-	return -1;
+	// fill up data up to request.size - 1 (the size counts the null terminator)
+	// notice we're working on std::string, not a c-string
+	size_t size = request.size == 0 ? 0 : request.size - 1;
+	msg.pop_into(request.data, size - request.num_returned - request.data.size());
+	bool is_last = request.num_returned + request.data.size() == size && (request.size == 0 || !msg.empty());
+
+	if(!is_last && (!request.is_streamed || request.data.empty()))
+	{
+		// still buffering
+		return 1;
+	}
+
+	if(is_last && request.size > 0)
+	{
+		// get rid of the null-terminator
+		unsigned char null_char;
+		msg.pop(&null_char, 1);
+		// supress warning when compiling with NDEBUG
+		(void) null_char;
+		// the next character must be the null terminator
+		assert(null_char == '\0');
+	}
+
+	// assign return value (no copy)
+	ret.fd = raw_request.first;
+	ret.data.swap(request.data);
+	request.data.clear();
+	ret.is_first = request.num_returned == 0;
+	ret.is_last = is_last;
+	ret.size = size;
+	request.num_returned += ret.data.size();
+
+	if(is_last)
+	{
+		// clear the current buffer for new requests
+		int num_erased = requests.erase(raw_request.first);
+		// suppress warning
+		(void) num_erased;
+		assert(num_erased == 1);
+	}
+
+	if(!msg.empty())
+	{
+		// the next request (or piece) is there; go to the back of the queue so other connections get a turn
+		this->socket_ref.set_ready(raw_request.first);
+	}
+
+	if(ret.is_first && ret.is_last)
+	{
+		Peer &peer = this->peers[ret.fd];
+
+		if(peer.is_negotiating)
+		{
+			// the answer to HELLO; a legacy server sends HELLO back, changed
+			peer.is_negotiating = false;
+			__atomic_store_n(&this->has_64bit[ret.fd], ret.data == STRING_CHANNEL_HELLO_REPLY, __ATOMIC_RELEASE);
+			return this->parse_piece(ret);
+		}
+
+		if(peer.num_received++ == 0 && ret.data == STRING_CHANNEL_HELLO)
+		{
+			__atomic_store_n(&this->has_64bit[ret.fd], true, __ATOMIC_RELEASE);
+			std::string reply = STRING_CHANNEL_HELLO_REPLY;
+			this->push_header(ret.fd, reply.size());
+			this->socket_ref.get_write_buf(ret.fd).push(reply.c_str(), reply.size() + 1);
+			return this->parse_piece(ret);
+		}
+	}
+
+	return 0;
 }
 
-void StringChannel::send(int dst_fd, std::string &str)
+void StringChannel::push_header(int dst_fd, uint64_t size)
 {
-	if(str.size() > std::numeric_limits<unsigned int>::max() - 1)
+	Sockets::Message &send = this->socket_ref.get_write_buf(dst_fd);
+
+	if(size <= std::numeric_limits<unsigned int>::max() - 1)
 	{
-		// the request is too large, don't process it since the header only has 4 bytes
+		// format: (4-byte size of message, message)
+		unsigned int nsize = htonl(static_cast<unsigned int>(size + 1));
+		unsigned char header[4] = {
+			static_cast<unsigned char>(nsize >> 24), static_cast<unsigned char>(nsize >> 16),
+			static_cast<unsigned char>(nsize >> 8), static_cast<unsigned char>(nsize)
+		};
+		send.push(header, sizeof(header));
 		return;
 	}
 
-	// do the copying here since it doesn't require mutual exclusion
-	const char *c_str = str.c_str();
-	assert(c_str[str.size()] == '\0');
-	pthread_mutex_lock(&this->lock);
+	// can_frame() said the remote takes it
+	assert(__atomic_load_n(&this->has_64bit[dst_fd], __ATOMIC_ACQUIRE));
+
+	// format: (4 zero bytes, 8-byte size of message, message)
+	unsigned char header[12] = {0};
+
+	for(size_t i = 0; i < 8; i++)
 	{
-		Sockets::Message &send = this->socket_ref.get_write_buf(dst_fd);
-		// format: (4-byte size of message, message)
-		unsigned int nsize = htonl(static_cast<unsigned int>(str.size() + 1));
-		send.push_back(nsize >> 24);
-		send.push_back(nsize >> 16);
-		send.push_back(nsize >> 8);
-		send.push_back(nsize);
-		std::copy(c_str, c_str + (str.size()+1), std::inserter(send, send.end()));
+		header[4 + i] = static_cast<unsigned char>((size + 1) >> (56 - 8 * i));
 	}
-	pthread_mutex_unlock(&this->lock);
-	// increase the number of pending requests by 1
-	this->num_pending++;
+
+	send.push(header, sizeof(header));
 }
 
-int StringChannel::sync()
+bool StringChannel::can_frame(int dst_fd, uint64_t size)
 {
-	pthread_mutex_lock(&this->lock);
-	int retval = this->socket_ref.sync();
-	pthread_mutex_unlock(&this->lock);
+	if(size <= std::numeric_limits<unsigned int>::max() - 1)
+	{
+		return true;
+	}
+
+	// too large for the 4-byte size, and the remote may not take anything else
+	return dst_fd >= 0 && dst_fd < FD_SETSIZE && __atomic_load_n(&this->has_64bit[dst_fd], __ATOMIC_ACQUIRE);
+}
+
+void StringChannel::queue(Frame &frame)
+{
+	this->outbound.push(frame);
+	this->wake();
+}
+
+void StringChannel::push_frame(Frame &frame)
+{
+	if(!this->socket_ref.is_connected(frame.fd))
+	{
+		// the remote disconnected after the frame was queued
+		return;
+	}
+
+	Sockets::Message &send = this->socket_ref.get_write_buf(frame.fd);
+
+	if(frame.kind == Frame::HELLO)
+	{
+		this->peers[frame.fd].is_negotiating = true;
+	}
+
+	if(frame.kind == Frame::STRING || frame.kind == Frame::HELLO)
+	{
+		this->push_header(frame.fd, frame.data.size());
+	}
+
+	if(frame.kind == Frame::HEADER)
+	{
+		this->push_header(frame.fd, frame.size);
+	}
+	else
+	{
+		// with the null terminator at the end, except in the middle of a string
+		send.push(frame.data.c_str(), frame.data.size() + (frame.kind == Frame::PIECE ? 0 : 1));
+	}
+}
+
+int StringChannel::send(int dst_fd, std::string &str)
+{
+	if(!this->can_frame(dst_fd, str.size()))
+	{
+		return -1;
+	}
+
+	Frame frame;
+	frame.fd = dst_fd;
+	frame.kind = Frame::STRING;
+	frame.data.swap(str);
+	// increase the number of pending requests by 1, before the reply can come back
+	__atomic_add_fetch(&this->num_pending, 1, __ATOMIC_SEQ_CST);
+	this->queue(frame);
+	return 0;
+}
+
+void StringChannel::negotiate(int dst_fd)
+{
+	Frame frame;
+	frame.fd = dst_fd;
+	frame.kind = Frame::HELLO;
+	frame.data = STRING_CHANNEL_HELLO;
+	this->queue(frame);
+}
+
+int StringChannel::send_header(int dst_fd, uint64_t size)
+{
+	if(!this->can_frame(dst_fd, size))
+	{
+		return -1;
+	}
+
+	Frame frame;
+	frame.fd = dst_fd;
+	frame.kind = Frame::HEADER;
+	frame.size = size;
+	this->queue(frame);
+	return 0;
+}
+
+void StringChannel::send_piece(int dst_fd, std::string &data, bool is_last)
+{
+	Frame frame;
+	frame.fd = dst_fd;
+	frame.kind = is_last ? Frame::LAST_PIECE : Frame::PIECE;
+	frame.data.swap(data);
+
+	if(is_last)
+	{
+		// increase the number of pending requests by 1
+		__atomic_add_fetch(&this->num_pending, 1, __ATOMIC_SEQ_CST);
+	}
+
+	this->queue(frame);
+}
+
+int StringChannel::sync(long timeout_ms)
+{
+	if(__atomic_exchange_n(&this->is_wake_pending, false, __ATOMIC_SEQ_CST))
+	{
+		// everything queued so far is moved below; no need for select() to wake up for it
+		uint64_t count;
+		ssize_t count_size = read(this->wake_fd, &count, sizeof(count));
+		// supress warning when compiling with NDEBUG
+		(void) count_size;
+	}
+
+	Frame frame;
+
+	while(this->outbound.pop(frame))
+	{
+		this->push_frame(frame);
+	}
+
+	int retval = this->socket_ref.sync(this->wake_fd, timeout_ms);
+	std::vector<int> fds;
+	this->socket_ref.take_disconnected(fds);
+
+	for(size_t i = 0; i < fds.size(); i++)
+	{
+		// a new connection can get the same fd
+		this->requests.erase(fds[i]);
+		this->peers.erase(fds[i]);
+		this->disconnected_fds.push_back(fds[i]);
+
+		if(fds[i] < FD_SETSIZE)
+		{
+			__atomic_store_n(&this->has_64bit[fds[i]], false, __ATOMIC_RELEASE);
+		}
+	}
+
+	Piece piece;
+
+	int status;
+
+	// every connection that got bytes, so nothing is left for after the next select()
+	while((status = this->parse_piece(piece)) >= 0)
+	{
+		if(status == 0)
+		{
+			this->inbound.push(piece);
+		}
+	}
+
 	return retval;
 }
 
+void StringChannel::wake()
+{
+	// one write is enough until the next sync() picks it up
+	if(!__atomic_exchange_n(&this->is_wake_pending, true, __ATOMIC_SEQ_CST))
+	{
+		uint64_t one = 1;
+		ssize_t count_size = write(this->wake_fd, &one, sizeof(one));
+		// supress warning when compiling with NDEBUG
+		(void) count_size;
+	}
+}
+
+bool StringChannel::is_sending(int dst_fd)
+{
+	return !this->outbound.empty() || !this->socket_ref.get_write_buf(dst_fd).empty();
+}
+
+void StringChannel::take_disconnected(std::vector<int> &ret)
+{
+	ret.clear();
+	ret.swap(this->disconnected_fds);
+}
+
 bool StringChannel::is_closing()
 {
-	bool retval;
-	int num_pending_temp;
-	pthread_mutex_lock(&this->lock);
-	retval = this->closing;
-	num_pending_temp = this->num_pending;
-	pthread_mutex_unlock(&this->lock);
-	return retval && num_pending_temp == 0;
+	return __atomic_load_n(&this->closing, __ATOMIC_SEQ_CST) && __atomic_load_n(&this->num_pending, __ATOMIC_SEQ_CST) == 0;
 }
 
 void StringChannel::close()
 {
-	pthread_mutex_lock(&this->lock);
-	this->closing = true;
-	pthread_mutex_unlock(&this->lock);
+	__atomic_store_n(&this->closing, true, __ATOMIC_SEQ_CST);
+	// the syncing thread may be waiting in select()
+	this->wake();
 }
 
 }
@@ -1,47 +1,153 @@
 #ifndef _channel_hpp_
 #define _channel_hpp_
 
+#include "spsc_queue.hpp"
 #include <map>
-#include <pthread.h>
+#include <stdint.h>
 #include <string>
+#include <vector>
+#include <sys/select.h>
+
+/*
+	Framing
+		- legacy: a 4-byte size (counting the null terminator), the string, '\0'
+		- 64-bit: a 4-byte size of 0 (no legacy sender makes one), an 8-byte size in network
+				order, the string, '\0'
+	Every receiver takes both. A 64-bit frame is only sent when the string doesn't fit in a
+	legacy one, and only to a peer that is known to take it: one that has sent a 64-bit frame,
+	or one that answered negotiate() with HELLO_REPLY. A legacy server answers HELLO like any
+	other string, which tells the client to stay with legacy frames.
+*/
+#define STRING_CHANNEL_HELLO "\x01stringchannel 64-bit frames?"
+#define STRING_CHANNEL_HELLO_REPLY "\x01stringchannel 64-bit frames!"
 
 namespace TCP
 {
 class Sockets;
 
-// all public methods are synchronized by a mutex
+/*
+	no locks: the application and the network talk through 2 lock-free queues
+		- outbound: send(), negotiate(), send_header() and send_piece() queue a frame and
+				return; sync() moves the queued frames into the write buffers
+		- inbound: sync() parses whatever has arrived into strings (or pieces) and
+				receive_any()/receive_piece() take them
+		- the sending thread writes to an eventfd when it queues a frame, so a sync()
+				that is waiting in select() comes back to send it
+	so there is one thread that sends, one that receives and one that syncs
+	(any of them can be the same thread)
+*/
 class StringChannel
 {
 private: // typedefs
 	struct StringRequest
 	{
-		unsigned int size;
+		bool has_size; // whether the size has been read
+		uint64_t size;
 		std::string data;
+		bool is_streamed; // returned in pieces
+		size_t num_returned; // bytes of data already returned in pieces
+		StringRequest() : has_size(false), size(0), is_streamed(false), num_returned(0) {}
 	};
 	typedef std::map<int, StringRequest> Requests;
 
+	// what the syncing thread knows about the other end of a connection
+	struct Peer
+	{
+		bool is_negotiating; // sent HELLO; the next string is the answer
+		unsigned long num_received; // whole strings
+		Peer() : is_negotiating(false), num_received(0) {}
+	};
+	typedef std::map<int, Peer> Peers;
+
+	// queued by the sending thread, framed by the syncing thread
+	struct Frame
+	{
+		enum Kind { STRING, HELLO, HEADER, PIECE, LAST_PIECE };
+		int fd;
+		Kind kind;
+		uint64_t size; // HEADER only
+		std::string data;
+	};
+
+public: // typedefs
+	// a string, or part of one if it's streamed
+	struct Piece
+	{
+		int fd;
+		std::string data;
+		bool is_first; // data starts the string
+		bool is_last; // data ends the string
+		uint64_t size; // of the whole string
+	};
+
 private: // data
 	Sockets &socket_ref;
 	Requests requests;
-	pthread_mutex_t lock;
+	Peers peers;
+	SpscQueue<Frame> outbound;
+	SpscQueue<Piece> inbound;
+	int wake_fd; // eventfd
+	bool is_wake_pending; // the eventfd has been written since the last sync()
+	// takes 64-bit frames; set by the syncing thread, read by the sending thread
+	bool has_64bit[FD_SETSIZE];
+	std::vector<int> disconnected_fds; // since the last take_disconnected()
 	bool closing;
 	int num_pending;
+	size_t stream_size;
 
 private: // helpers
 
-	// unsynchronized helper
-	int receive_any_helper(std::pair<int,std::string> &ret);
+	// the syncing thread's side
+	// parse_piece() returns 0 for a piece, 1 if the next connection is still buffering
+	// and -1 once every connection has been looked at
+	int parse_piece(Piece &ret);
+	void push_header(int dst_fd, uint64_t size);
+	void push_frame(Frame &frame);
+
+	// whether a string of size bytes can be framed for dst_fd
+	bool can_frame(int dst_fd, uint64_t size);
+	void queue(Frame &frame);
 
 public:
 	StringChannel(Sockets &socket_ref);
 	~StringChannel();
 
-	// synchronous send/receive
+	// receive_any() and send() never block
 	int receive_any(std::pair<int,std::string> &ret);
-	void send(int dst_fd, std::string &str);
+	// fails if str needs a 64-bit frame and dst_fd isn't known to take one;
+	// takes str (by swap)
+	int send(int dst_fd, std::string &str);
+
+	// asks the remote (a server) whether it takes 64-bit frames; call right after
+	// connecting, before sending anything. The answer is never returned by receive_any()
+	void negotiate(int dst_fd);
+
+	// strings of at least size bytes are received in pieces, as their bytes come in
+	// (0, the default, turns it off); receive_any() must not be used with streaming.
+	// call before the first sync()
+	void set_stream_size(size_t size);
+
+	// the next string or piece of one; pieces of a string come in order
+	int receive_piece(Piece &ret);
+
+	// a reply in pieces: the size of the whole string, then the pieces in order
+	// send_piece() takes data (by swap)
+	int send_header(int dst_fd, uint64_t size);
+	void send_piece(int dst_fd, std::string &data, bool is_last);
+
+	// writes the queued frames and waits (up to timeout_ms, -1 for no limit) for
+	// the network or wake(), then reads; syncing thread only
+	int sync(long timeout_ms = -1);
+
+	// makes a waiting sync() return; safe from any thread
+	void wake();
+
+	// whether there are frames or bytes waiting to go to dst_fd; syncing thread only
+	bool is_sending(int dst_fd);
 
-	// synchronous version of Sockets::sync()
-	int sync();
+	// the fds that were disconnected since the last call, so the application can drop
+	// its state before a new connection gets the same fd; syncing thread only
+	void take_disconnected(std::vector<int> &ret);
 
 	// effectively needs an infinite loop; this method does not block
 	bool is_closing();
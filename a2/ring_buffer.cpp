@@ -0,0 +1,228 @@
+#include "ring_buffer.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace TCP
+{
+
+RingBuffer::RingBuffer() : head(0), count(0)
+{
+}
+
+size_t RingBuffer::size() const
+{
+	return this->count;
+}
+
+bool RingBuffer::empty() const
+{
+	return this->count == 0;
+}
+
+size_t RingBuffer::capacity() const
+{
+	return this->data.size();
+}
+
+void RingBuffer::grow(size_t min_capacity)
+{
+	if(min_capacity <= this->capacity())
+	{
+		return;
+	}
+
+	size_t new_capacity = std::max(this->capacity(), static_cast<size_t>(64));
+
+	while(new_capacity < min_capacity)
+	{
+		new_capacity *= 2;
+	}
+
+	// unwrap the stored bytes into the new block
+	size_t num_bytes = this->count;
+	std::vector<unsigned char> new_data(new_capacity);
+	this->pop(&new_data[0], num_bytes);
+	this->data.swap(new_data);
+	this->head = 0;
+	this->count = num_bytes;
+}
+
+int RingBuffer::get_used(unsigned char *ptrs[2], size_t lens[2])
+{
+	size_t first = std::min(this->count, this->capacity() - this->head);
+
+	if(first == 0)
+	{
+		return 0;
+	}
+
+	ptrs[0] = &this->data[this->head];
+	lens[0] = first;
+
+	if(first == this->count)
+	{
+		return 1;
+	}
+
+	ptrs[1] = &this->data[0];
+	lens[1] = this->count - first;
+	return 2;
+}
+
+int RingBuffer::get_free(unsigned char *ptrs[2], size_t lens[2])
+{
+	size_t capacity = this->capacity();
+
+	if(this->count == capacity)
+	{
+		return 0;
+	}
+
+	size_t tail = (this->head + this->count) % capacity;
+	// free space runs from tail to head (wrapping)
+	size_t first = tail >= this->head ? capacity - tail : this->head - tail;
+	ptrs[0] = &this->data[tail];
+	lens[0] = first;
+
+	if(first == capacity - this->count)
+	{
+		return 1;
+	}
+
+	ptrs[1] = &this->data[0];
+	lens[1] = capacity - this->count - first;
+	return 2;
+}
+
+void RingBuffer::push(const void *src, size_t n)
+{
+	this->grow(this->count + n);
+	const unsigned char *from = static_cast<const unsigned char*>(src);
+	unsigned char *ptrs[2];
+	size_t lens[2];
+	int num_pieces = this->get_free(ptrs, lens);
+
+	for(int i = 0; i < num_pieces && n > 0; i++)
+	{
+		size_t len = std::min(lens[i], n);
+		memcpy(ptrs[i], from, len);
+		from += len;
+		n -= len;
+		this->count += len;
+	}
+
+	assert(n == 0);
+}
+
+void RingBuffer::peek(void *dst, size_t n)
+{
+	assert(n <= this->count);
+	unsigned char *to = static_cast<unsigned char*>(dst);
+	unsigned char *ptrs[2];
+	size_t lens[2];
+	int num_pieces = this->get_used(ptrs, lens);
+
+	for(int i = 0; i < num_pieces && n > 0; i++)
+	{
+		size_t len = std::min(lens[i], n);
+		memcpy(to, ptrs[i], len);
+		to += len;
+		n -= len;
+	}
+}
+
+void RingBuffer::pop(void *dst, size_t n)
+{
+	this->peek(dst, n);
+	this->count -= n;
+	// an empty buffer starts over at 0, which keeps the next reads and writes in one piece
+	this->head = this->count == 0 ? 0 : (this->head + n) % this->capacity();
+}
+
+size_t RingBuffer::pop_into(std::string &dst, size_t n)
+{
+	unsigned char *ptrs[2];
+	size_t lens[2];
+	int num_pieces = this->get_used(ptrs, lens);
+	size_t ret = 0;
+
+	for(int i = 0; i < num_pieces && ret < n; i++)
+	{
+		size_t len = std::min(lens[i], n - ret);
+		dst.append(reinterpret_cast<char*>(ptrs[i]), len);
+		ret += len;
+	}
+
+	this->head = this->count == ret ? 0 : (this->head + ret) % this->capacity();
+	this->count -= ret;
+	return ret;
+}
+
+ssize_t RingBuffer::read_from(int fd, size_t n)
+{
+	this->grow(this->count + n);
+	unsigned char *ptrs[2];
+	size_t lens[2];
+	int num_pieces = this->get_free(ptrs, lens);
+	struct iovec iov[2];
+	int num_iov = 0;
+
+	for(int i = 0; i < num_pieces && n > 0; i++, num_iov++)
+	{
+		iov[i].iov_base = ptrs[i];
+		iov[i].iov_len = std::min(lens[i], n);
+		n -= iov[i].iov_len;
+	}
+
+	ssize_t ret = readv(fd, iov, num_iov);
+
+	if(ret > 0)
+	{
+		this->count += ret;
+	}
+
+	return ret;
+}
+
+ssize_t RingBuffer::write_to(int fd)
+{
+	unsigned char *ptrs[2];
+	size_t lens[2];
+	int num_pieces = this->get_used(ptrs, lens);
+	struct iovec iov[2];
+
+	for(int i = 0; i < num_pieces; i++)
+	{
+		iov[i].iov_base = ptrs[i];
+		iov[i].iov_len = lens[i];
+	}
+
+	// writev() with MSG_NOSIGNAL: a remote that has gone away gives EPIPE instead of killing us with SIGPIPE
+	struct msghdr header;
+	memset(&header, 0, sizeof(header));
+	header.msg_iov = iov;
+	header.msg_iovlen = num_pieces;
+	ssize_t ret = sendmsg(fd, &header, MSG_NOSIGNAL);
+
+	if(ret > 0)
+	{
+		this->head = this->count == static_cast<size_t>(ret) ? 0 : (this->head + ret) % this->capacity();
+		this->count -= ret;
+	}
+
+	return ret;
+}
+
+void RingBuffer::shrink(size_t max_capacity)
+{
+	if(this->empty() && this->capacity() > max_capacity)
+	{
+		std::vector<unsigned char>().swap(this->data);
+		this->head = 0;
+	}
+}
+
+}
@@ -0,0 +1,66 @@
+#ifndef _ring_buffer_hpp_
+#define _ring_buffer_hpp_
+
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace TCP
+{
+
+/*
+	a FIFO of bytes in one contiguous block that wraps around
+		- read()/write() go straight into/out of the block (at most 2 pieces each)
+		- everything else copies with memcpy
+		- the block grows (doubling) when a push or a read needs more room
+	not synchronized; copyable so it can live in std::map
+*/
+class RingBuffer
+{
+private: // data
+	std::vector<unsigned char> data;
+	size_t head; // index of the first byte
+	size_t count; // number of bytes stored
+
+private: // helpers
+
+	// make room for at least min_capacity bytes; the stored bytes start at 0 afterwards
+	void grow(size_t min_capacity);
+
+	// the stored bytes (or the free space) as up to 2 pieces; returns the number of pieces
+	int get_used(unsigned char *ptrs[2], size_t lens[2]);
+	int get_free(unsigned char *ptrs[2], size_t lens[2]);
+
+public:
+	RingBuffer();
+
+	size_t size() const;
+	bool empty() const;
+	size_t capacity() const;
+
+	// append n bytes
+	void push(const void *src, size_t n);
+
+	// copy n bytes (n <= size()) from the front into dst, leaving them in the buffer
+	void peek(void *dst, size_t n);
+
+	// remove n bytes (n <= size()) from the front into dst
+	void pop(void *dst, size_t n);
+
+	// remove up to n bytes from the front and append them to dst; returns the number moved
+	size_t pop_into(std::string &dst, size_t n);
+
+	// read() at most n bytes from fd to the back; returns what read() returns
+	ssize_t read_from(int fd, size_t n);
+
+	// write() as much as fd (a socket) takes from the front; returns what write() returns,
+	// and never raises SIGPIPE
+	ssize_t write_to(int fd);
+
+	// give the memory back if it's empty and holds more than max_capacity
+	void shrink(size_t max_capacity);
+};
+
+}
+
+#endif
@@ -3,8 +3,10 @@
 #include <cassert>
 #include <cstring>
 #include <errno.h>
+#include <fcntl.h>
 #include <iostream>
 #include <netdb.h>
+#include <stdint.h>
 #include <unistd.h>
 
 int TCP::Sockets::create_socket()
@@ -12,6 +14,15 @@ int TCP::Sockets::create_socket()
 	return socket(AF_INET, SOCK_STREAM, 0);
 }
 
+void TCP::Sockets::set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+	int retval = fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	// supress warning when compiling with NDEBUG
+	(void) retval;
+	assert(flags >= 0 && retval >= 0);
+}
+
 TCP::Sockets::Sockets() : local_fd(-1)
 {
 }
@@ -90,34 +101,62 @@ void TCP::Sockets::get_name(std::string *hostname, int *port) const
 	*port = ntohs(sin.sin_port);
 }
 
-void TCP::Sockets::setup_read_fds(fd_set &fds) const
+size_t TCP::Sockets::get_read_size(int fd)
+{
+	if(this->local_fd != -1 && this->get_write_buf(fd).size() >= SOCKET_BUF_SIZE)
+	{
+		// (servers only) the remote isn't keeping up with the replies; let TCP hold the requests back
+		// a client keeps reading, or it and the server could end up waiting for each other
+		return 0;
+	}
+
+	// we don't want to expand the buffer beyond SOCKET_BUF_SIZE
+	return SOCKET_BUF_SIZE - std::min(this->get_read_buf(fd).size(), static_cast<size_t>(SOCKET_BUF_SIZE));
+}
+
+void TCP::Sockets::setup_read_fds(fd_set &fds)
 {
-	// similar to write fds, except read fds also need socket_fd (to check for incoming connections)
-	this->setup_write_fds(fds);
-	FD_SET(this->local_fd, &fds);
+	FD_ZERO(&fds);
+
+	for(Fds::iterator it = this->connected_fds.begin(); it != this->connected_fds.end(); it++)
+	{
+		// socket_fd is always there (to check for incoming connections)
+		if(*it == this->local_fd || this->get_read_size(*it) > 0)
+		{
+			FD_SET(*it, &fds);
+		}
+	}
 }
 
-void TCP::Sockets::setup_write_fds(fd_set &fds) const
+void TCP::Sockets::setup_write_fds(fd_set &fds)
 {
 	FD_ZERO(&fds);
 
 	for(Fds::iterator it = this->connected_fds.begin(); it != this->connected_fds.end(); it++)
 	{
-		if(*it != this->local_fd)
+		if(*it != this->local_fd && !this->get_write_buf(*it).empty())
 		{
 			FD_SET(*it, &fds);
 		}
 	}
 }
 
-int TCP::Sockets::sync()
+int TCP::Sockets::sync(int wake_fd, long timeout_ms)
 {
 	fd_set readfds, writefds;
 	setup_read_fds(readfds);
 	setup_write_fds(writefds);
-	int max_fd = this->get_max_fd();
-	char buf[SOCKET_BUF_SIZE];
-	int retval = select(max_fd + 1, &readfds, &writefds, NULL, NULL);
+	int max_fd = std::max(this->get_max_fd(), wake_fd);
+
+	if(wake_fd >= 0)
+	{
+		FD_SET(wake_fd, &readfds);
+	}
+
+	struct timeval timeout;
+	timeout.tv_sec = timeout_ms / 1000;
+	timeout.tv_usec = timeout_ms % 1000 * 1000;
+	int retval = select(max_fd + 1, &readfds, &writefds, NULL, timeout_ms < 0 ? NULL : &timeout);
 
 	if(retval < 0 && errno != EINTR)
 	{
@@ -125,9 +164,26 @@ int TCP::Sockets::sync()
 		return retval;
 	}
 
-	for(Fds::iterator it = this->connected_fds.begin(); it != this->connected_fds.end(); it++)
+	if(retval <= 0)
+	{
+		// timed out or interrupted; the fd_sets aren't meaningful
+		return 0;
+	}
+
+	if(wake_fd >= 0 && FD_ISSET(wake_fd, &readfds))
+	{
+		// reset the eventfd so the next select() waits again
+		uint64_t count;
+		ssize_t count_size = read(wake_fd, &count, sizeof(count));
+		// supress warning when compiling with NDEBUG
+		(void) count_size;
+	}
+
+	for(Fds::iterator it = this->connected_fds.begin(); it != this->connected_fds.end();)
 	{
 		int fd = *it;
+		// disconnect() erases fd from connected_fds, so move on before handling it
+		it++;
 
 		if(FD_ISSET(fd, &readfds))
 		{
@@ -146,6 +202,7 @@ int TCP::Sockets::sync()
 					return -1;
 				}
 
+				set_nonblocking(clientfd);
 				bool inserted = this->connected_fds.insert(clientfd).second;
 				// supress warning when compiling with NDEBUG
 				(void) inserted;
@@ -154,29 +211,29 @@ int TCP::Sockets::sync()
 			}
 			else
 			{
-				// copy message to a buffer
+				// read straight into the buffer
 				Message &msg = get_read_buf(fd);
-				size_t size = std::min(SOCKET_BUF_SIZE - msg.size(), sizeof buf);
+				size_t size = this->get_read_size(fd);
 
 				if(size > 0)
 				{
 					// sockets for remote connections
-					size_t count = read(fd, buf, sizeof(buf));
+					ssize_t count = msg.read_from(fd, size);
 
-					if(count == 0)
+					if(count == 0 || (count < 0 && errno != EAGAIN && errno != EINTR))
 					{
-						// remote sent EOF -- disconnect remote
+						// remote sent EOF (or reset) -- disconnect remote
 						this->disconnect(fd);
+						continue;
 					}
-					else
+
+					if(count > 0)
 					{
-						std::copy(buf, buf+count, std::inserter(msg, msg.end()));
-						// msg could have stored requests that haven't been sent
-						assert(msg.size() >= count);
+						this->set_ready(fd);
 					}
 				}
 
-				// otherwise full; don't read -- we don't want to expand the buffer beyond SOCKET_BUF_SIZE
+				// otherwise full; don't read
 			}
 		}
 
@@ -190,20 +247,17 @@ int TCP::Sockets::sync()
 
 			if(!msg.empty())
 			{
-				size_t i;
-
-				for(i = 0; i < sizeof buf && !msg.empty(); i++)
+				// as much as the socket takes; the rest waits for the next sync()
+				if(msg.write_to(fd) < 0 && errno != EAGAIN && errno != EINTR)
 				{
-					buf[i] = msg.front();
-					msg.pop_front();
+					// this can happen when the remote shutdown before the reply was sent (EPIPE, ECONNRESET)
+					// for example, running valgrind can slow the server significantly and this can happen;
+					// drop it like an EOF, so the other connections are still served
+					this->disconnect(fd);
+					continue;
 				}
 
-				if(write(fd, buf, i) < 0)
-				{
-					// this can happen when the remote shutdown before the reply was sent
-					// for example, running valgrind can slow the server significantly and this can happen
-					return -1;
-				}
+				msg.shrink(SOCKET_BUF_SIZE);
 			}
 		}
 	}
@@ -222,8 +276,7 @@ int TCP::Sockets::get_max_fd() const
 		return max_fd;
 	}
 
-	// this should not happen
-	assert(false);
+	// the server closed the connection (client), or there's nothing to select on
 	return -1;
 }
 
@@ -260,6 +313,7 @@ int TCP::Sockets::connect_remote(char *hostname, int port)
 	}
 
 	// connect to remote machine (server) successfully)
+	set_nonblocking(temp_fd);
 	this->connected_fds.insert(temp_fd);
 	return temp_fd;
 }
@@ -271,6 +325,22 @@ void TCP::Sockets::disconnect(int fd)
 	assert(it != this->connected_fds.end());
 	close(fd);
 	this->connected_fds.erase(it);
+	// the fd number can be reused by the next connection
+	this->read_buf.erase(fd);
+	this->write_buf.erase(fd);
+
+	if(static_cast<size_t>(fd) < this->is_ready.size())
+	{
+		// its entry in ready_queue is dropped when it reaches the front
+		this->is_ready[fd] = false;
+	}
+
+	this->disconnected_fds.push_back(fd);
+}
+
+bool TCP::Sockets::is_connected(int fd) const
+{
+	return fd != this->local_fd && this->connected_fds.count(fd) > 0;
 }
 
 TCP::Sockets::Message &TCP::Sockets::get_read_buf(int dst_fd)
@@ -285,17 +355,41 @@ TCP::Sockets::Message &TCP::Sockets::get_write_buf(int dst_fd)
 
 int TCP::Sockets::get_available_msg(std::pair<int,Message*> &ret)
 {
-	Requests::iterator it = this->read_buf.begin();
-
-	for(; it != this->read_buf.end(); it++)
+	while(!this->ready_queue.empty())
 	{
-		if(!it->second.empty())
+		int fd = this->ready_queue.front();
+		this->ready_queue.pop_front();
+
+		if(this->is_ready[fd])
 		{
-			ret.first = it->first;
-			ret.second = &it->second;
+			this->is_ready[fd] = false;
+			ret.first = fd;
+			ret.second = &this->read_buf[fd];
 			return 0;
 		}
 	}
 
 	return -1;
 }
+
+void TCP::Sockets::set_ready(int fd)
+{
+	assert(fd >= 0);
+
+	if(static_cast<size_t>(fd) >= this->is_ready.size())
+	{
+		this->is_ready.resize(fd + 1, false);
+	}
+
+	if(!this->is_ready[fd])
+	{
+		this->is_ready[fd] = true;
+		this->ready_queue.push_back(fd);
+	}
+}
+
+void TCP::Sockets::take_disconnected(std::vector<int> &ret)
+{
+	ret.clear();
+	ret.swap(this->disconnected_fds);
+}
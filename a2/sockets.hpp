@@ -1,18 +1,20 @@
 #ifndef _sockets_hpp_
 #define _sockets_hpp_
 
+#include "ring_buffer.hpp"
 #include <deque>
 #include <map>
 #include <set>
 #include <string>
 #include <sys/select.h>
+#include <vector>
 
 /*
-	this buffer should be large enough to prevent segfaults
-	notice that StringChannel assumes all 4 bytes for the string size
-	to be read at once, so SOCKET_BUF_SIZE must be at least 5
+	sync() stops reading from a connection once its read buffer holds this many bytes,
+	or, on a server, while its write buffer does; write buffers grow as needed and give
+	their memory back above this size once drained
 */
-#define SOCKET_BUF_SIZE 2048
+#define SOCKET_BUF_SIZE 65536
 
 /*
 	Conventions
@@ -27,27 +29,41 @@ namespace TCP
 class Sockets
 {
 public: // typedefs
-	typedef std::deque<unsigned char> Message;
+	typedef RingBuffer Message;
 	typedef std::map<int, Message> Requests;
 	typedef std::set<int> Fds;
+	typedef std::deque<int> ReadyQueue;
 
 private: // data
 	Requests read_buf, write_buf;
 	int local_fd;
 	Fds connected_fds;
+	// fds whose read buffer has data nobody has looked at yet, oldest first;
+	// an fd is queued at most once (is_ready[fd]), entries of disconnected fds are skipped
+	ReadyQueue ready_queue;
+	std::vector<bool> is_ready;
+	// disconnected since the last take_disconnected()
+	std::vector<int> disconnected_fds;
 
 private: // functions
 
-	// get the max fd for select()
+	// get the max fd for select(); -1 if there are no connections
 	int get_max_fd() const;
 
-	// each time sync() is called, fd_set's are repopulated with these 2 methods
-	void setup_read_fds(fd_set &fds) const;
-	void setup_write_fds(fd_set &fds) const;
+	// how many bytes sync() reads from fd, at most
+	size_t get_read_size(int fd);
+
+	// each time sync() is called, fd_set's are repopulated with these 2 methods;
+	// only fds that sync() would read from or has bytes to write to are set, so select() can block
+	void setup_read_fds(fd_set &fds);
+	void setup_write_fds(fd_set &fds);
 
 	// used by connect_remote and bind_and_listen
 	int create_socket();
 
+	// connections are non-blocking, so a large write can't stall sync()
+	static void set_nonblocking(int fd);
+
 	// IMPORTANT: this is not idempotent
 	void disconnect(int fd);
 
@@ -64,11 +80,23 @@ public:
 	// getters for the buffer; IMPORTANT: not synchronized
 	Message &get_read_buf(int dst_fd);
 	Message &get_write_buf(int dst_fd);
+
+	// takes the fd that has waited longest off the ready queue, in O(1);
+	// the caller puts it back with set_ready() if it leaves a whole message in the buffer
 	int get_available_msg(std::pair<int,Message*> &ret);
+	void set_ready(int fd);
+
+	// the fds that were disconnected since the last call, so their state can be dropped
+	// before the fd numbers are reused
+	void take_disconnected(std::vector<int> &ret);
 
 	// send all requests in the write buffer to remote,
-	// and read all incoming messages to the read buffer
-	int sync();
+	// and read all incoming messages to the read buffer;
+	// waits up to timeout_ms (-1 for no limit) for something to do, or for wake_fd (an eventfd) to be written
+	int sync(int wake_fd = -1, long timeout_ms = -1);
+
+	// false once the remote has disconnected
+	bool is_connected(int fd) const;
 
 	// get the hostname and port # for the SERVER ONLY
 	void get_name(std::string *hostname, int *port) const;
@@ -0,0 +1,92 @@
+#ifndef _spsc_queue_hpp_
+#define _spsc_queue_hpp_
+
+#include <algorithm>
+#include <cstddef>
+
+namespace TCP
+{
+
+/*
+	an unbounded lock-free FIFO for exactly one producer thread and one consumer thread
+	(they can be the same thread)
+		- a linked list that always has a dummy node at the front; the producer only
+				touches tail, the consumer only head, and they meet through the next pointers
+		- push() never waits, it only allocates a node
+		- values are swapped in and out, so strings aren't copied
+*/
+template <typename T>
+class SpscQueue
+{
+private: // typedefs
+	struct Node
+	{
+		T value;
+		Node *next;
+		Node() : next(NULL) {}
+	};
+
+private: // data
+	Node *head; // consumer only; the dummy node
+	// keeps head and tail on separate cache lines
+	char padding[64 - sizeof(Node*)];
+	Node *tail; // producer only
+
+private: // not copyable
+	SpscQueue(const SpscQueue &);
+	SpscQueue &operator=(const SpscQueue &);
+
+public:
+	SpscQueue() : tail(NULL)
+	{
+		this->head = this->tail = new Node;
+	}
+
+	~SpscQueue()
+	{
+		while(this->head != NULL)
+		{
+			Node *next = this->head->next;
+			delete this->head;
+			this->head = next;
+		}
+	}
+
+	// producer only; value is left with what a default T holds
+	void push(T &value)
+	{
+		Node *node = new Node;
+		std::swap(node->value, value);
+		// publishes the value along with the node
+		__atomic_store_n(&this->tail->next, node, __ATOMIC_RELEASE);
+		this->tail = node;
+	}
+
+	// consumer only
+	bool pop(T &ret)
+	{
+		Node *next = __atomic_load_n(&this->head->next, __ATOMIC_ACQUIRE);
+
+		if(next == NULL)
+		{
+			return false;
+		}
+
+		// next becomes the dummy node
+		std::swap(ret, next->value);
+		next->value = T();
+		delete this->head;
+		this->head = next;
+		return true;
+	}
+
+	// consumer only
+	bool empty() const
+	{
+		return __atomic_load_n(&this->head->next, __ATOMIC_ACQUIRE) == NULL;
+	}
+};
+
+}
+
+#endif
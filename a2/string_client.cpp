@@ -1,11 +1,17 @@
 #include "channel.hpp"
 #include "sockets.hpp"
 #include <cassert>
+#include <cerrno>
 #include <cstdlib>
 #include <ctime>
+#include <deque>
 #include <iostream>
-#include <iostream>
+#include <poll.h>
 #include <pthread.h>
+#include <unistd.h>
+
+// stdin is read in blocks of this size in the pipelined mode
+#define STDIN_BLOCK_SIZE 65536
 
 // packed as arguments for handle_requests
 struct SocketReference
@@ -23,6 +29,7 @@ static void *handle_requests(void *data)
 	while(!channel.is_closing())
 	{
 		std::pair<int,std::string> request;
+		// waits for the server, or for the main thread to send or close
 		channel.sync();
 
 		if(channel.receive_any(request) < 0)
@@ -37,6 +44,108 @@ static void *handle_requests(void *data)
 	return NULL;
 }
 
+/*
+	the pipelined mode (-w window): one thread waits in poll() for stdin or the server,
+	sends every line of stdin as soon as fewer than window requests are in flight,
+	and prints the replies as they arrive (the server keeps them in order)
+*/
+static int run_pipelined(TCP::StringChannel &channel, int server_fd, size_t window)
+{
+	std::deque<std::string> lines; // read from stdin, not sent yet
+	std::string partial; // the last line so far
+	size_t num_in_flight = 0;
+	bool is_eof = false;
+	char buf[STDIN_BLOCK_SIZE];
+
+	while(!is_eof || !lines.empty() || num_in_flight > 0)
+	{
+		// fill the window
+		while(!lines.empty() && num_in_flight < window)
+		{
+			if(channel.send(server_fd, lines.front()) >= 0)
+			{
+				num_in_flight++;
+			}
+
+			lines.pop_front();
+		}
+
+		// only read stdin while there is room, so a big file doesn't end up in memory
+		struct pollfd fds[2];
+		fds[0].fd = server_fd;
+		fds[0].events = channel.is_sending(server_fd) ? (POLLIN | POLLOUT) : POLLIN;
+		fds[1].fd = is_eof || lines.size() >= window ? -1 : STDIN_FILENO;
+		fds[1].events = POLLIN;
+
+		if(poll(fds, 2, -1) < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+
+			return -1;
+		}
+
+		if(fds[1].revents != 0)
+		{
+			ssize_t count = read(STDIN_FILENO, buf, sizeof(buf));
+
+			if(count < 0 && errno != EINTR && errno != EAGAIN)
+			{
+				return -1;
+			}
+
+			is_eof = count == 0;
+
+			for(ssize_t i = 0, start = 0; i < count; i++)
+			{
+				if(buf[i] == '\n')
+				{
+					partial.append(buf + start, i - start);
+					lines.push_back(std::string());
+					lines.back().swap(partial);
+					start = i + 1;
+				}
+				else if(i == count - 1)
+				{
+					partial.append(buf + start, count - start);
+				}
+			}
+
+			if(is_eof && !partial.empty())
+			{
+				// like std::getline, a last line without a newline still counts
+				lines.push_back(std::string());
+				lines.back().swap(partial);
+			}
+		}
+
+		if(fds[0].revents != 0)
+		{
+			if(fds[0].revents & POLLNVAL)
+			{
+				// sync() read EOF from the server and closed the fd
+				std::cerr << "the server closed the connection" << std::endl;
+				return -1;
+			}
+
+			// poll() already waited
+			channel.sync(0);
+			std::pair<int,std::string> reply;
+
+			while(channel.receive_any(reply) >= 0)
+			{
+				std::cout << "Server: " << reply.second << '\n';
+				num_in_flight--;
+			}
+		}
+	}
+
+	std::cout.flush();
+	return 0;
+}
+
 static int setup_client(TCP::Sockets &socket)
 {
 	char *hostname = getenv("SERVER_ADDRESS");
@@ -61,8 +170,23 @@ static int setup_client(TCP::Sockets &socket)
 	return socket.connect_remote(hostname, port);
 }
 
-int main()
+int main(int argc, char **argv)
 {
+	size_t window = 0;
+	int c;
+
+	while((c = getopt(argc, argv, "w:")) != -1)
+	{
+		if(c != 'w' || atol(optarg) <= 0)
+		{
+			std::cerr << "usage: " << argv[0] << " [-w window]" << std::endl
+			          << "  -w  pipeline stdin with up to window requests in flight (default: one line every 2 seconds)" << std::endl;
+			return 1;
+		}
+
+		window = atol(optarg);
+	}
+
 	TCP::Sockets socket;
 	int server_fd = setup_client(socket);
 
@@ -74,6 +198,14 @@ int main()
 	}
 
 	TCP::StringChannel channel(socket);
+	// so lines of 4 GiB or more can be sent to a server that takes them
+	channel.negotiate(server_fd);
+
+	if(window > 0)
+	{
+		return run_pipelined(channel, server_fd, window) < 0 ? 1 : 0;
+	}
+
 	SocketReference ref = {server_fd, socket, channel};
 	pthread_t net_sync_thread;
 
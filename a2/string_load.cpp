@@ -0,0 +1,473 @@
+#include "channel.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <iostream>
+#include <netdb.h>
+#include <poll.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+/*
+	Load generator for stringServer. It opens many connections and keeps up to
+	"depth" StringChannel frames in flight on each one, then reports requests/s,
+	MB/s and latency percentiles. Replies are checked against cap_first_letter().
+	The frames are encoded here the same way StringChannel does (4-byte size including
+	the null terminator, the string, '\0'), so the generator doesn't share the
+	server's buffering. With -x, every connection starts with StringChannel::negotiate()'s
+	HELLO and sends 64-bit frames if the server agrees.
+*/
+
+// marks HELLO in in_flight
+static const size_t HELLO_INDEX = static_cast<size_t>(-1);
+
+struct Options
+{
+	int num_conns;
+	int depth;
+	std::vector<size_t> sizes;
+	double duration_s;
+	double warmup_s;
+	bool use_64bit;
+};
+
+struct Connection
+{
+	int fd;
+	std::string out; // frames that haven't been written yet
+	size_t out_offset;
+	std::string in; // bytes of replies that haven't been parsed yet
+	std::deque<std::pair<long, size_t> > in_flight; // send time and payload index, in order
+	size_t next_payload;
+	bool is_64bit; // the server agreed to 64-bit frames
+};
+
+static long now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static void usage(const char *prog)
+{
+	std::cerr << "usage: " << prog << " [-c connections] [-d depth] [-s size[,size...]] [-t seconds] [-w warmup seconds] [-x]" << std::endl
+	          << "  -d  frames in flight per connection (pipelining)" << std::endl
+	          << "  -s  string sizes in bytes, used in turn" << std::endl
+	          << "  -x  negotiate and send 64-bit frames" << std::endl
+	          << "SERVER_ADDRESS and SERVER_PORT must be set." << std::endl;
+	exit(1);
+}
+
+// the server's transform, to check replies
+static std::string cap_first_letter(std::string str)
+{
+	bool is_prev_space = true;
+
+	for(size_t i = 0; i < str.size(); i++)
+	{
+		if(isspace(str[i]))
+		{
+			is_prev_space = true;
+			continue;
+		}
+
+		str[i] = is_prev_space ? toupper(str[i]) : tolower(str[i]);
+		is_prev_space = false;
+	}
+
+	return str;
+}
+
+// words of mixed case letters and digits
+static std::string make_payload(size_t size, unsigned seed)
+{
+	static const char letters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+	std::string ret(size, ' ');
+
+	for(size_t i = 0; i < size; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+
+		if((seed >> 16) % 7 != 0)
+		{
+			ret[i] = letters[(seed >> 8) % (sizeof(letters) - 1)];
+		}
+	}
+
+	return ret;
+}
+
+// the byte order of StringChannel::send()
+static std::string make_frame(const std::string &payload, bool is_64bit)
+{
+	std::string ret;
+
+	if(is_64bit)
+	{
+		ret.append(4, '\0');
+
+		for(int i = 0; i < 8; i++)
+		{
+			ret += static_cast<char>(static_cast<uint64_t>(payload.size() + 1) >> (56 - 8 * i));
+		}
+	}
+	else
+	{
+		unsigned int nsize = htonl(static_cast<unsigned int>(payload.size() + 1));
+		ret += static_cast<char>(nsize >> 24);
+		ret += static_cast<char>(nsize >> 16);
+		ret += static_cast<char>(nsize >> 8);
+		ret += static_cast<char>(nsize);
+	}
+
+	ret += payload;
+	ret += '\0';
+	return ret;
+}
+
+// the byte order of StringChannel::receive_any(); false if the header isn't all there
+static bool get_frame_size(const std::string &buf, size_t offset, size_t &size, size_t &header_size)
+{
+	if(buf.size() - offset < 4)
+	{
+		return false;
+	}
+
+	const unsigned char *p = reinterpret_cast<const unsigned char*>(buf.data() + offset);
+	unsigned int nsize = (p[0] << 24) + (p[1] << 16) + (p[2] << 8) + p[3];
+
+	if(nsize != 0)
+	{
+		size = ntohl(nsize);
+		header_size = 4;
+		return true;
+	}
+
+	if(buf.size() - offset < 12)
+	{
+		return false;
+	}
+
+	size = 0;
+
+	for(int i = 4; i < 12; i++)
+	{
+		size = (size << 8) | p[i];
+	}
+
+	header_size = 12;
+	return true;
+}
+
+static int connect_server(const char *hostname, int port)
+{
+	struct hostent *entity = gethostbyname(hostname);
+
+	if(entity == NULL)
+	{
+		return -1;
+	}
+
+	struct sockaddr_in remote_info;
+	memset(&remote_info, 0, sizeof(remote_info));
+	remote_info.sin_family = AF_INET;
+	remote_info.sin_port = htons(port);
+	memcpy(&remote_info.sin_addr, entity->h_addr, entity->h_length);
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if(fd < 0 || connect(fd, (struct sockaddr *)&remote_info, sizeof(remote_info)) < 0)
+	{
+		if(fd >= 0)
+		{
+			close(fd);
+		}
+
+		return -1;
+	}
+
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+}
+
+static long percentile(const std::vector<long> &sorted, double p)
+{
+	if(sorted.empty())
+	{
+		return 0;
+	}
+
+	size_t i = static_cast<size_t>(p * sorted.size());
+	return sorted[std::min(i, sorted.size() - 1)];
+}
+
+int main(int argc, char **argv)
+{
+	Options opt;
+	opt.num_conns = 1;
+	opt.depth = 1;
+	opt.duration_s = 5;
+	opt.warmup_s = 1;
+	opt.use_64bit = false;
+	int c;
+
+	while((c = getopt(argc, argv, "c:d:s:t:w:x")) != -1)
+	{
+		switch(c)
+		{
+			case 'c':
+				opt.num_conns = atoi(optarg);
+				break;
+
+			case 'd':
+				opt.depth = atoi(optarg);
+				break;
+
+			case 's':
+				for(char *tok = strtok(optarg, ","); tok != NULL; tok = strtok(NULL, ","))
+				{
+					opt.sizes.push_back(strtoul(tok, NULL, 10));
+				}
+
+				break;
+
+			case 't':
+				opt.duration_s = atof(optarg);
+				break;
+
+			case 'w':
+				opt.warmup_s = atof(optarg);
+				break;
+
+			case 'x':
+				opt.use_64bit = true;
+				break;
+
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	if(opt.sizes.empty())
+	{
+		opt.sizes.push_back(64);
+	}
+
+	const char *hostname = getenv("SERVER_ADDRESS");
+	const char *port_chars = getenv("SERVER_PORT");
+
+	if(hostname == NULL || port_chars == NULL || opt.num_conns < 1 || opt.depth < 1 || opt.duration_s <= 0)
+	{
+		usage(argv[0]);
+	}
+
+	// one payload per size, and the reply it should get
+	std::vector<std::string> frames, frames_64bit, expected;
+
+	for(size_t i = 0; i < opt.sizes.size(); i++)
+	{
+		std::string payload = make_payload(opt.sizes[i], i + 1);
+		frames.push_back(make_frame(payload, false));
+		frames_64bit.push_back(make_frame(payload, true));
+		expected.push_back(cap_first_letter(payload));
+	}
+
+	std::vector<Connection> conns(opt.num_conns);
+	std::vector<struct pollfd> pfds(opt.num_conns);
+
+	for(int i = 0; i < opt.num_conns; i++)
+	{
+		conns[i].fd = connect_server(hostname, atoi(port_chars));
+
+		if(conns[i].fd < 0)
+		{
+			std::cerr << "cannot connect to " << hostname << ":" << port_chars << std::endl;
+			return 1;
+		}
+
+		conns[i].out_offset = 0;
+		conns[i].next_payload = i % frames.size();
+		conns[i].is_64bit = false;
+		pfds[i].fd = conns[i].fd;
+	}
+
+	long start_us = now_us();
+
+	for(int i = 0; opt.use_64bit && i < opt.num_conns; i++)
+	{
+		// the frames before the answer are legacy ones
+		conns[i].out = make_frame(STRING_CHANNEL_HELLO, false);
+		conns[i].in_flight.push_back(std::make_pair(start_us, HELLO_INDEX));
+	}
+
+	long measure_us = start_us + static_cast<long>(opt.warmup_s * 1e6);
+	long end_us = measure_us + static_cast<long>(opt.duration_s * 1e6);
+	std::vector<long> latencies;
+	unsigned long bytes = 0, num_bad = 0;
+	int num_64bit = 0;
+	int num_open = opt.num_conns;
+	char buf[64 * 1024];
+
+	while(num_open > 0)
+	{
+		long now = now_us();
+
+		if(now >= end_us + 5000000L)
+		{
+			std::cerr << "gave up on " << num_open << " connections with replies outstanding" << std::endl;
+			break;
+		}
+
+		for(int i = 0; i < opt.num_conns; i++)
+		{
+			Connection &conn = conns[i];
+
+			// keep the pipeline full until the end, then drain it
+			while(now < end_us && conn.fd >= 0 && conn.in_flight.size() < static_cast<size_t>(opt.depth))
+			{
+				conn.out += conn.is_64bit ? frames_64bit[conn.next_payload] : frames[conn.next_payload];
+				conn.in_flight.push_back(std::make_pair(now, conn.next_payload));
+				conn.next_payload = (conn.next_payload + 1) % frames.size();
+			}
+
+			pfds[i].events = conn.out_offset < conn.out.size() ? (POLLIN | POLLOUT) : POLLIN;
+			pfds[i].revents = 0;
+		}
+
+		if(poll(&pfds[0], pfds.size(), 100) < 0 && errno != EINTR)
+		{
+			perror("poll");
+			return 1;
+		}
+
+		for(int i = 0; i < opt.num_conns; i++)
+		{
+			Connection &conn = conns[i];
+
+			if(conn.fd < 0)
+			{
+				continue;
+			}
+
+			if(pfds[i].revents & POLLOUT)
+			{
+				ssize_t n = write(conn.fd, conn.out.data() + conn.out_offset, conn.out.size() - conn.out_offset);
+
+				if(n > 0)
+				{
+					conn.out_offset += n;
+
+					if(conn.out_offset == conn.out.size())
+					{
+						conn.out.clear();
+						conn.out_offset = 0;
+					}
+				}
+			}
+
+			if(pfds[i].revents & (POLLIN | POLLHUP | POLLERR))
+			{
+				ssize_t n = read(conn.fd, buf, sizeof(buf));
+
+				if(n <= 0 && !(n < 0 && (errno == EAGAIN || errno == EINTR)))
+				{
+					std::cerr << "server closed connection " << i << std::endl;
+					close(conn.fd);
+					conn.fd = pfds[i].fd = -1;
+					num_open--;
+					continue;
+				}
+
+				if(n > 0)
+				{
+					conn.in.append(buf, n);
+				}
+			}
+
+			// parse every complete reply
+			size_t offset = 0;
+			long done_us = now_us();
+
+			size_t size, header_size;
+
+			while(get_frame_size(conn.in, offset, size, header_size))
+			{
+				if(conn.in.size() - offset - header_size < size)
+				{
+					break;
+				}
+
+				assert(!conn.in_flight.empty());
+				std::pair<long, size_t> sent = conn.in_flight.front();
+				conn.in_flight.pop_front();
+
+				if(sent.second == HELLO_INDEX)
+				{
+					// a legacy server sends HELLO back, changed
+					conn.is_64bit = conn.in.compare(offset + header_size, size, STRING_CHANNEL_HELLO_REPLY,
+					                                sizeof(STRING_CHANNEL_HELLO_REPLY)) == 0;
+					num_64bit += conn.is_64bit ? 1 : 0;
+					offset += header_size + size;
+					continue;
+				}
+
+				// size counts the null terminator
+				const std::string &want = expected[sent.second];
+
+				if(size != want.size() + 1 || conn.in.compare(offset + header_size, size - 1, want) != 0)
+				{
+					num_bad++;
+				}
+
+				if(sent.first >= measure_us)
+				{
+					latencies.push_back(done_us - sent.first);
+					bytes += size - 1;
+				}
+
+				offset += header_size + size;
+			}
+
+			conn.in.erase(0, offset);
+
+			if(done_us >= end_us && conn.in_flight.empty())
+			{
+				close(conn.fd);
+				conn.fd = pfds[i].fd = -1;
+				num_open--;
+			}
+		}
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	printf("connections %d, depth %d, sizes", opt.num_conns, opt.depth);
+
+	for(size_t i = 0; i < opt.sizes.size(); i++)
+	{
+		printf("%s%lu", i == 0 ? " " : ",", static_cast<unsigned long>(opt.sizes[i]));
+	}
+
+	printf(", %.1fs (+%.1fs warmup)\n", opt.duration_s, opt.warmup_s);
+	if(opt.use_64bit)
+	{
+		printf("64-bit frames on %d of %d connections\n", num_64bit, opt.num_conns);
+	}
+
+	printf("requests %lu, bad replies %lu\n", static_cast<unsigned long>(latencies.size()), num_bad);
+	printf("requests/s %.1f, MB/s %.2f\n", latencies.size() / opt.duration_s, bytes / opt.duration_s / 1e6);
+	printf("latency(us) p50 %ld, p99 %ld, p999 %ld, max %ld\n", percentile(latencies, 0.5), percentile(latencies, 0.99),
+	       percentile(latencies, 0.999), latencies.empty() ? 0 : latencies.back());
+	return num_bad == 0 && num_open == 0 ? 0 : 1;
+}
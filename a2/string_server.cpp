@@ -1,35 +1,182 @@
+#include "cap_first_letter.hpp"
 #include "channel.hpp"
 #include "sockets.hpp"
+#include "worker_pool.hpp"
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
+#include <deque>
 #include <iostream>
+#include <map>
+#include <pthread.h>
+#include <unistd.h>
+#include <vector>
 
-void cap_first_letter(std::string &str)
+// a piece of a streamed request, and the seq of that request
+struct StreamPiece
 {
-	bool is_prev_space = true;
+	unsigned long seq;
+	TCP::StringChannel::Piece piece;
+};
 
-	for(size_t i = 0; i < str.size(); i++)
+// of the next Connection
+static unsigned long next_generation = 0;
+
+// replies must go back in the order of the requests on each connection; a streamed request takes a seq too
+struct Connection
+{
+	unsigned long next_seq; // of the next request
+	unsigned long next_send; // seq of the next reply to send
+	std::map<unsigned long, std::string> finished; // replies that are ahead of next_send
+	std::deque<StreamPiece> streamed; // pieces of streamed requests that are behind other replies
+	bool is_prev_space; // of the request being streamed back, at the end of the last piece
+	// tells this connection's jobs from those of an earlier one on the same fd
+	unsigned long generation;
+	Connection() : next_seq(0), next_send(0), is_prev_space(true), generation(next_generation++) {}
+};
+typedef std::map<int, Connection> Connections;
+
+// keeps printed requests from interleaving
+static pthread_mutex_t print_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// run by the workers
+static void handle_request(std::string &str)
+{
+	pthread_mutex_lock(&print_lock);
+	std::cout << str << std::endl;
+	pthread_mutex_unlock(&print_lock);
+	cap_first_letter(str);
+}
+
+// run by the workers when a job is done, so the network thread doesn't stay in select()
+static void wake_channel(void *channel)
+{
+	static_cast<TCP::StringChannel*>(channel)->wake();
+}
+
+// STRING_STREAM_SIZE, or 1 MiB; 0 turns streaming off
+static size_t get_stream_size()
+{
+	const char *size_chars = getenv("STRING_STREAM_SIZE");
+	return size_chars == NULL ? 1 << 20 : strtoul(size_chars, NULL, 10);
+}
+
+// transforms a piece of a streamed request and sends it back
+static void send_stream_piece(TCP::StringChannel::Piece &piece, Connection &conn, TCP::StringChannel &channel)
+{
+	if(piece.is_first)
 	{
-		if(isspace(str[i]))
+		conn.is_prev_space = true;
+		channel.send_header(piece.fd, piece.size);
+	}
+
+	pthread_mutex_lock(&print_lock);
+	std::cout << piece.data;
+
+	if(piece.is_last)
+	{
+		std::cout << std::endl;
+	}
+
+	pthread_mutex_unlock(&print_lock);
+
+	if(!piece.data.empty())
+	{
+		conn.is_prev_space = cap_first_letter(&piece.data[0], piece.data.size(), conn.is_prev_space);
+	}
+
+	channel.send_piece(piece.fd, piece.data, piece.is_last);
+
+	if(piece.is_last)
+	{
+		conn.next_send++;
+	}
+}
+
+// sends the replies and streamed pieces that are next in line on fd
+static void send_ready(int fd, Connections &connections, TCP::StringChannel &channel)
+{
+	Connection &conn = connections[fd];
+
+	while(true)
+	{
+		std::map<unsigned long, std::string>::iterator it = conn.finished.find(conn.next_send);
+
+		if(it != conn.finished.end())
 		{
-			// no need to mutate any space characters
-			is_prev_space = true;
-			continue;
+			channel.send(fd, it->second);
+			conn.finished.erase(it);
+			conn.next_send++;
 		}
-
-		if(is_prev_space)
+		else if(!conn.streamed.empty() && conn.streamed.front().seq == conn.next_send)
 		{
-			// previous character was a space but the current one isn't, so turn the current character to upper case
-			str[i] = toupper(str[i]);
+			send_stream_piece(conn.streamed.front().piece, conn, channel);
+			conn.streamed.pop_front();
 		}
 		else
 		{
-			str[i] = tolower(str[i]);
+			break;
 		}
+	}
 
-		is_prev_space = false;
+	if(conn.next_send == conn.next_seq)
+	{
+		// nothing in flight
+		connections.erase(fd);
 	}
 }
 
+static void send_finished(WorkerPool::Job &job, Connections &connections, TCP::StringChannel &channel)
+{
+	Connections::iterator it = connections.find(job.fd);
+
+	if(it == connections.end() || it->second.generation != job.generation)
+	{
+		// the client disconnected; fd may be someone else's by now
+		return;
+	}
+
+	it->second.finished[job.seq].swap(job.str);
+	send_ready(job.fd, connections, channel);
+}
+
+// a large request is transformed and sent back as it arrives, so it never has to fit in memory;
+// its pieces only wait here while the replies to the requests before it are still being worked on
+static void stream_piece(TCP::StringChannel::Piece &piece, Connections &connections, TCP::StringChannel &channel)
+{
+	Connection &conn = connections[piece.fd];
+
+	if(piece.is_first)
+	{
+		conn.next_seq++;
+	}
+
+	conn.streamed.push_back(StreamPiece());
+	StreamPiece &queued = conn.streamed.back();
+	queued.seq = conn.next_seq - 1;
+	queued.piece.fd = piece.fd;
+	queued.piece.data.swap(piece.data);
+	queued.piece.is_first = piece.is_first;
+	queued.piece.is_last = piece.is_last;
+	queued.piece.size = piece.size;
+	send_ready(piece.fd, connections, channel);
+}
+
+// STRING_WORKERS, or one per core; 0 means the network thread does the work itself
+// (the default on a single core, where handing strings over only adds latency)
+static int get_num_workers()
+{
+	const char *num_chars = getenv("STRING_WORKERS");
+
+	if(num_chars != NULL)
+	{
+		return std::max(atoi(num_chars), 0);
+	}
+
+	long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return num_cores > 1 ? num_cores : 0;
+}
+
 void test_cap()
 {
 #ifndef NDEBUG
@@ -57,6 +204,33 @@ void test_cap()
 	str = "document specification FOR CS454 a2 milestone";
 	cap_first_letter(str);
 	assert(str == "Document Specification For Cs454 A2 Milestone");
+	// the vector kernels against the plain loop, for lengths around the block sizes;
+	// every other string has some non-ASCII bytes
+	const char chars[] = "aZm@[`{ \t\n\v\f\r09";
+
+	for(size_t size = 0; size < 200; size++)
+	{
+		for(int round = 0; round < 20; round++)
+		{
+			str.resize(size);
+
+			for(size_t i = 0; i < size; i++)
+			{
+				str[i] = round % 2 == 1 && rand() % 16 == 0 ? rand() % 256 : chars[rand() % (sizeof(chars) - 1)];
+			}
+
+			std::string expected = str;
+			cap_first_letter_scalar(&expected[0], size, true);
+			// in 2 pieces, as a stream would give it
+			std::string pieces = str;
+			size_t split = size == 0 ? 0 : rand() % size;
+			bool is_prev_space = cap_first_letter(&pieces[0], split, true);
+			cap_first_letter(&pieces[0] + split, size - split, is_prev_space);
+			cap_first_letter(str);
+			assert(str == expected);
+			assert(pieces == expected);
+		}
+	}
 #endif
 }
 
@@ -78,21 +252,63 @@ int main()
 	std::cout << "SERVER_ADDRESS " << address << std::endl;
 	std::cout << "SERVER_PORT " << port << std::endl;
 	TCP::StringChannel channel(socket);
+	channel.set_stream_size(get_stream_size());
+	// with workers, this thread only does the networking
+	int num_workers = get_num_workers();
+	WorkerPool *pool = num_workers > 0 ? new WorkerPool(num_workers, &handle_request) : NULL;
+
+	if(pool != NULL)
+	{
+		pool->set_on_done(&wake_channel, &channel);
+	}
+
+	Connections connections;
 
 	while(true)
 	{
+		// waits for requests, room to write, or a finished job
 		channel.sync();
-		std::pair<int,std::string> request;
+		TCP::StringChannel::Piece piece;
+		WorkerPool::Job job;
+		std::vector<int> disconnected_fds;
+		channel.take_disconnected(disconnected_fds);
 
-		if(channel.receive_any(request) < 0)
+		for(size_t i = 0; i < disconnected_fds.size(); i++)
 		{
-			continue;
+			// what is still in flight for it is dropped when it comes back
+			connections.erase(disconnected_fds[i]);
 		}
 
-		std::cout << request.second << std::endl;
-		// process request and send the result to client
-		cap_first_letter(request.second);
-		channel.send(request.first, request.second);
+		// hand everything that is ready to the workers before the next sync()
+		while(channel.receive_piece(piece) >= 0)
+		{
+			if(!piece.is_first || !piece.is_last)
+			{
+				stream_piece(piece, connections, channel);
+				continue;
+			}
+
+			if(pool == NULL)
+			{
+				// process request and send the result to client
+				handle_request(piece.data);
+				channel.send(piece.fd, piece.data);
+				continue;
+			}
+
+			Connection &conn = connections[piece.fd];
+			job.fd = piece.fd;
+			job.generation = conn.generation;
+			job.seq = conn.next_seq++;
+			job.str.swap(piece.data);
+			pool->submit(job);
+		}
+
+		// send the replies that are next in line on their connection
+		while(pool != NULL && pool->get_done(job))
+		{
+			send_finished(job, connections, channel);
+		}
 	}
 
 	// unreachable
@@ -0,0 +1,151 @@
+#include "worker_pool.hpp"
+#include <algorithm>
+#include <cassert>
+#include <exception>
+
+// swaps instead of copying the string
+static void swap_jobs(WorkerPool::Job &a, WorkerPool::Job &b)
+{
+	std::swap(a.fd, b.fd);
+	std::swap(a.generation, b.generation);
+	std::swap(a.seq, b.seq);
+	std::swap(a.worker, b.worker);
+	a.str.swap(b.str);
+}
+
+WorkerPool::WorkerPool(int num_workers, Transform transform)
+	: transform(transform), on_done(NULL), on_done_arg(NULL)
+{
+	assert(num_workers > 0);
+
+	if(pthread_mutex_init(&this->done_lock, NULL) != 0)
+	{
+		// should not happen in the student environment
+		assert(false);
+		throw std::exception();
+	}
+
+	for(int i = 0; i < num_workers; i++)
+	{
+		Worker *worker = new Worker;
+		worker->pool = this;
+		worker->stopping = false;
+		worker->num_outstanding = 0;
+
+		if(pthread_mutex_init(&worker->lock, NULL) != 0 || pthread_cond_init(&worker->cond, NULL) != 0
+		        || pthread_create(&worker->thread, NULL, &WorkerPool::run, static_cast<void*>(worker)) != 0)
+		{
+			// should not happen in the student environment
+			assert(false);
+			throw std::exception();
+		}
+
+		this->workers.push_back(worker);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	for(size_t i = 0; i < this->workers.size(); i++)
+	{
+		Worker *worker = this->workers[i];
+		pthread_mutex_lock(&worker->lock);
+		worker->stopping = true;
+		pthread_cond_signal(&worker->cond);
+		pthread_mutex_unlock(&worker->lock);
+		pthread_join(worker->thread, NULL);
+		pthread_cond_destroy(&worker->cond);
+		pthread_mutex_destroy(&worker->lock);
+		delete worker;
+	}
+
+	pthread_mutex_destroy(&this->done_lock);
+}
+
+void *WorkerPool::run(void *data)
+{
+	Worker &worker = *static_cast<Worker*>(data);
+	WorkerPool &pool = *worker.pool;
+
+	while(true)
+	{
+		Job job;
+		pthread_mutex_lock(&worker.lock);
+
+		while(worker.jobs.empty() && !worker.stopping)
+		{
+			pthread_cond_wait(&worker.cond, &worker.lock);
+		}
+
+		if(worker.jobs.empty())
+		{
+			// stopping, and nothing left to do
+			pthread_mutex_unlock(&worker.lock);
+			return NULL;
+		}
+
+		swap_jobs(job, worker.jobs.front());
+		worker.jobs.pop_front();
+		pthread_mutex_unlock(&worker.lock);
+		pool.transform(job.str);
+		pthread_mutex_lock(&pool.done_lock);
+		pool.done.push_back(Job());
+		swap_jobs(pool.done.back(), job);
+		pthread_mutex_unlock(&pool.done_lock);
+
+		if(pool.on_done != NULL)
+		{
+			pool.on_done(pool.on_done_arg);
+		}
+	}
+}
+
+void WorkerPool::set_on_done(Notify on_done, void *arg)
+{
+	this->on_done = on_done;
+	this->on_done_arg = arg;
+}
+
+void WorkerPool::submit(Job &job)
+{
+	size_t best = 0;
+
+	for(size_t i = 1; i < this->workers.size(); i++)
+	{
+		if(this->workers[i]->num_outstanding < this->workers[best]->num_outstanding)
+		{
+			best = i;
+		}
+	}
+
+	Worker &worker = *this->workers[best];
+	worker.num_outstanding++;
+	job.worker = best;
+	pthread_mutex_lock(&worker.lock);
+	worker.jobs.push_back(Job());
+	swap_jobs(worker.jobs.back(), job);
+	pthread_cond_signal(&worker.cond);
+	pthread_mutex_unlock(&worker.lock);
+}
+
+bool WorkerPool::get_done(Job &ret)
+{
+	pthread_mutex_lock(&this->done_lock);
+
+	if(this->done.empty())
+	{
+		pthread_mutex_unlock(&this->done_lock);
+		return false;
+	}
+
+	swap_jobs(ret, this->done.front());
+	this->done.pop_front();
+	pthread_mutex_unlock(&this->done_lock);
+	this->workers[ret.worker]->num_outstanding--;
+	return true;
+}
+
+size_t WorkerPool::size() const
+{
+	return this->workers.size();
+}
@@ -0,0 +1,73 @@
+#ifndef _worker_pool_hpp_
+#define _worker_pool_hpp_
+
+#include <deque>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+/*
+	a pool of threads that run the server's transform on strings
+		- submit() and get_done() are only called by the network thread; they never block on a transform
+		- each worker has its own job queue, and a job goes to the worker with the
+				fewest jobs outstanding, so one huge string holds up as few others as possible
+		- jobs can finish out of order; seq lets the caller put replies back in order
+*/
+class WorkerPool
+{
+public: // typedefs
+	typedef void (*Transform)(std::string &str);
+	typedef void (*Notify)(void *arg);
+
+	struct Job
+	{
+		int fd;
+		unsigned long generation; // of the connection on fd; set by the caller, like seq
+		unsigned long seq;
+		std::string str;
+		int worker; // set by submit()
+	};
+
+private: // typedefs
+	struct Worker
+	{
+		WorkerPool *pool;
+		pthread_t thread;
+		pthread_mutex_t lock;
+		pthread_cond_t cond;
+		std::deque<Job> jobs;
+		bool stopping;
+		size_t num_outstanding; // submitted and not yet taken by get_done(); network thread only
+	};
+
+private: // data
+	Transform transform;
+	Notify on_done;
+	void *on_done_arg;
+	std::vector<Worker*> workers;
+	pthread_mutex_t done_lock;
+	std::deque<Job> done;
+
+private: // helpers
+	static void *run(void *data);
+
+public:
+	WorkerPool(int num_workers, Transform transform);
+
+	// finishes the jobs that were submitted, then joins the workers
+	~WorkerPool();
+
+	// on_done(arg) is called by a worker each time it finishes a job, e.g. to wake up
+	// a network thread that waits in select(); call before the first submit()
+	void set_on_done(Notify on_done, void *arg);
+
+	// takes job.str (by swap)
+	void submit(Job &job);
+
+	// a finished job, if any; does not block
+	bool get_done(Job &ret);
+
+	size_t size() const;
+};
+
+#endif
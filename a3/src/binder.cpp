@@ -1,63 +1,329 @@
 #include "common.hpp"
 #include "debug.hpp"
+#include "fan_out.hpp"
+#include "journal.hpp"
+#include "liveness.hpp"
 #include "name_service.hpp"
 #include "postman.hpp"
 #include "rpc.h"
 #include "sockets.hpp"
+#include "trace.hpp"
+#include "watchers.hpp"
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
 #include <iostream>
+#include <queue>
+#include <semaphore.h>
+#include <vector>
 
-static unsigned next_u32() // responsible for generating unique ids; note: binder is NOT multi-threaded
+int handle_request(Postman &postman, Journal &journal, Liveness &liveness, Watchers &watchers, Postman::Request &req);
+
+// the main thread only receives requests (see main()); these threads handle them
+class Workers
 {
-	static unsigned i = 0;
-	return i++;
+private: // data
+	Postman &postman;
+	Journal &journal;
+	Liveness &liveness;
+	Watchers &watchers;
+	std::queue<Postman::Request> requests;
+	pthread_t threads[BINDER_THREADS];
+	pthread_mutex_t lock;
+	sem_t sem; // one post per request, plus one per thread on terminate()
+	bool is_terminate;
+
+public: // methods
+	Workers(Postman &postman, Journal &journal, Liveness &liveness, Watchers &watchers);
+	~Workers();
+
+	void push(const Postman::Request &req);
+
+	// handle all queued requests and join the threads
+	void terminate();
+
+	friend void *run_worker(void *data);
+};
+
+void *run_worker(void *data)
+{
+	Workers &workers = *static_cast<Workers*>(data);
+
+	while(true)
+	{
+		sem_wait(&workers.sem);
+		Postman::Request req;
+		{
+			ScopedLock lock(workers.lock);
+
+			if(workers.requests.empty())
+			{
+				// woken up by terminate(), and nothing is left
+				assert(workers.is_terminate);
+				break;
+			}
+
+			req = workers.requests.front();
+			workers.requests.pop();
+		}
+		// the reply carries the request's trace
+		set_trace_id(req.message.trace_id);
+		long start_us = now_us();
+		Tracer::get().span(req.message.trace_id, "binder queued", req.received_us, start_us);
+		int retval = handle_request(workers.postman, workers.journal, workers.liveness, workers.watchers, req);
+		Tracer::get().span(req.message.trace_id, "binder", start_us, now_us(), message_type_name(req.message.msg_type));
+		set_trace_id(0);
+		(void) retval;
+		// the requester may have given up and disconnected before the reply was sent;
+		// otherwise there's a bug... or something hasn't been implemented
+		assert(retval >= 0 || !workers.postman.is_alive(req.fd, req.conn_id));
+	}
+
+	return NULL;
 }
 
-void terminate_servers(Postman &postman)
+Workers::Workers(Postman &postman, Journal &journal, Liveness &liveness, Watchers &watchers)
+	: postman(postman),
+	  journal(journal),
+	  liveness(liveness),
+	  watchers(watchers),
+	  is_terminate(false)
 {
-	NameService::Names names = postman.ns.get_all_names();
-	NameService::Names::iterator it;
+	// not going to check for errors
+	int retval;
+	(void) retval;
+	retval = sem_init(&this->sem, 0, 0);
+	assert(retval == 0);
+	retval = pthread_mutex_init(&this->lock, NULL);
+	assert(retval == 0);
 
-	for(it = names.begin(); it != names.end(); it++)
+	for(int i = 0; i < BINDER_THREADS; i++)
 	{
+		retval = pthread_create(&this->threads[i], NULL, &run_worker, static_cast<void*>(this));
+		assert(retval == 0);
+	}
+}
+
+Workers::~Workers()
+{
+	assert(this->is_terminate);
+	pthread_mutex_destroy(&this->lock);
+	sem_destroy(&this->sem);
+}
+
+void Workers::push(const Postman::Request &req)
+{
+	{
+		ScopedLock lock(this->lock);
+		this->requests.push(req);
+	}
+	sem_post(&this->sem);
+}
+
+void Workers::terminate()
+{
+	{
+		ScopedLock lock(this->lock);
+		this->is_terminate = true;
+	}
+
+	for(int i = 0; i < BINDER_THREADS; i++)
+	{
+		sem_post(&this->sem);
+	}
+
+	for(int i = 0; i < BINDER_THREADS; i++)
+	{
+		pthread_join(this->threads[i], NULL);
+	}
+}
+
+static long broadcast_timeout_ms()
+{
+	static long timeout_ms = get_env_long("BINDER_BROADCAST_TIMEOUT", BROADCAST_TIMEOUT);
+	return timeout_ms;
+}
+
+// shared by the jobs of one TERMINATE broadcast
+struct TerminateBroadcast
+{
+	Postman &postman;
+	std::vector<std::pair<int, unsigned> > conns; // to the servers that got TERMINATE
+	pthread_mutex_t mutex;
+
+	TerminateBroadcast(Postman &postman)
+		: postman(postman)
+	{
+		int retval = pthread_mutex_init(&this->mutex, NULL);
+		(void) retval;
+		assert(retval == 0);
+	}
+
+	~TerminateBroadcast()
+	{
+		pthread_mutex_destroy(&this->mutex);
+	}
+};
+
+static void terminate_job(void *data, const Name &name, long deadline_ms)
+{
+	TerminateBroadcast &broadcast = *static_cast<TerminateBroadcast*>(data);
+	Postman &postman = broadcast.postman;
 #ifndef NDEBUG
-		std::cout << "trying to terminate " << to_format(*it) << std::endl;
+	std::cout << "trying to terminate " << to_format(name) << std::endl;
 #endif
-		ScopedConnection conn(postman, it->ip, it->port);
-		int fd = conn.get_fd();
+	int fd = postman.connect_remote(name.ip, name.port, std::max(deadline_ms - now_ms(), 0L));
 
-		if(fd < 0)
-		{
-			// remote already dead
+	if(fd < 0)
+	{
+		// remote already dead
+#ifndef NDEBUG
+		std::cout << "remote already dead" << std::endl;
+#endif
+		return;
+	}
+
+	if(postman.send_terminate(fd) < 0)
+	{
 #ifndef NDEBUG
-			std::cout << "remote already dead" << std::endl;
+		std::cout << "cannot send terminate for " << to_format(name) << std::endl;
 #endif
-			continue;
+		// ???? maybe the server is busy? assume it's dead
+		postman.disconnect(fd);
+		return;
+	}
+
+	ScopedLock lock(broadcast.mutex);
+	broadcast.conns.push_back(std::make_pair(fd, postman.get_conn_id(fd)));
+}
+
+void terminate_servers(Postman &postman)
+{
+	long deadline_ms = now_ms() + broadcast_timeout_ms();
+	TerminateBroadcast broadcast(postman);
+	fan_out(postman.ns.get_all_names(), &terminate_job, &broadcast, BROADCAST_THREADS, deadline_ms);
+
+	// each server asks back (on its own connection) and then exits, which closes our connection;
+	// anything else, e.g. a heartbeat, is dropped since the binder is terminating
+	while(now_ms() < deadline_ms)
+	{
+		bool is_any_alive = false;
+
+		for(size_t i = 0; i < broadcast.conns.size() && !is_any_alive; i++)
+		{
+			is_any_alive = postman.is_alive(broadcast.conns[i].first, broadcast.conns[i].second);
 		}
 
-		if(postman.send_terminate(fd) < 0)
+		if(!is_any_alive)
+		{
+			break;
+		}
+
+		Postman::Request req;
+
+		if(postman.poll_and_receive_any(req, 10) >= 0 && req.message.msg_type == Postman::CONFIRM_TERMINATE)
 		{
 #ifndef NDEBUG
-			std::cout << "cannot send terminate for " << to_format(*it) << std::endl;
+			std::cout << "send terminate " << req.fd << std::endl;
 #endif
-			// ???? maybe the server is busy? assume it's dead
-			continue;
+			postman.send_confirm_terminate(req.fd);
 		}
+	}
+}
 
-		Postman::Request req;
+// shared by the jobs of one NEW_SERVER_EXECUTE broadcast
+struct ExecuteBroadcast
+{
+	Postman &postman;
+	Liveness &liveness;
+};
 
-		// timeout or the remote node has disconnected
-		while(postman.sync_and_receive_any(req, &fd) < 0
-		        && (req.fd == fd && req.message.msg_type != Postman::CONFIRM_TERMINATE));
+static void new_server_execute_job(void *data, const Name &name, long deadline_ms)
+{
+	ExecuteBroadcast &broadcast = *static_cast<ExecuteBroadcast*>(data);
+	Postman &postman = broadcast.postman;
+	ScopedConnection conn(postman, postman.connect_remote(name.ip, name.port, std::max(deadline_ms - now_ms(), 0L)));
+	int remote_fd = conn.get_fd();
+
+	if(remote_fd == CONNECT_TIMED_OUT)
+	{
+		// slow rather than dead; heartbeats decide
+		return;
+	}
+
+	if(remote_fd < 0)
+	{
+		// remote server is dead
+		unsigned remote_id;
+
+		if(postman.ns.resolve(name, remote_id) >= 0)
+		{
+			// remove it ... though not really needed to do so
+			postman.ns.kill(remote_id);
+			broadcast.liveness.forget(remote_id);
+		}
+
+		return;
+	}
 
+	postman.send_new_server_execute(remote_fd);
+}
+
+void kill_all(NameService &ns)
+{
+	NameService::Names names = ns.get_all_names();
+
+	for(size_t i = 0; i < names.size(); i++)
+	{
+		unsigned id;
+
+		if(ns.resolve(names[i], id) >= 0)
+		{
+			ns.kill(id);
+		}
+	}
+}
+
+// every server in the name directory gets a full timeout to send a heartbeat (to this binder)
+void watch_all(NameService &ns, Liveness &liveness)
+{
+	NameService::Names names = ns.get_all_names();
+
+	for(size_t i = 0; i < names.size(); i++)
+	{
+		unsigned id;
+
+		if(ns.resolve(names[i], id) >= 0)
+		{
+			liveness.add(id);
+		}
+	}
+}
+
+// requests that change the name directory; a standby gets them only if the primary is unreachable
+bool is_write(const Postman::Request &req)
+{
+	int type = req.message.msg_type;
+	return type == Postman::I_AM_SERVER || type == Postman::REGISTER || type == Postman::NEW_SERVER_EXECUTE;
+}
+
+// a standby stops following the primary, so nothing from it is applied after our own writes
+void take_over(Postman &postman, Liveness &liveness, int &primary_fd, unsigned primary_conn_id)
+{
 #ifndef NDEBUG
-		std::cout << "send terminate " << fd << std::endl;
+	std::cout << "taking over as the primary binder" << std::endl;
 #endif
-		postman.send_confirm_terminate(fd);
+
+	if(postman.is_alive(primary_fd, primary_conn_id))
+	{
+		postman.disconnect(primary_fd);
 	}
+
+	primary_fd = -1;
+	watch_all(postman.ns, liveness);
 }
 
-int handle_request(Postman &postman, Postman::Request &req)
+int handle_request(Postman &postman, Journal &journal, Liveness &liveness, Watchers &watchers, Postman::Request &req)
 {
 	NameService &ns = postman.ns;
 	int remote_fd = req.fd;
@@ -88,11 +354,14 @@ int handle_request(Postman &postman, Postman::Request &req)
 				// previous registered, and restarted running on the same machine and port number
 				// remove old records
 				ns.kill(remote_id);
+				liveness.forget(remote_id);
 			}
 
 			// get a new id and then register it into the name directory
-			remote_id = next_u32();
+			// (which also persists it -- see Journal -- before the server hears of it)
+			remote_id = journal.next_id(ns);
 			ns.register_name(remote_id, remote_name);
+			liveness.add(remote_id);
 			return postman.reply_server_ok(remote_fd, remote_id, remote_ns_version);
 		}
 
@@ -101,8 +370,7 @@ int handle_request(Postman &postman, Postman::Request &req)
 			unsigned remote_id = pop_i32(ss);
 			Function func = func_from_sstream(ss);
 			ns.register_fn(remote_id, func);
-			int retval = postman.reply_register(remote_fd, remote_ns_version);
-			return retval;
+			return postman.reply_register(remote_fd, remote_ns_version);
 		}
 
 		case Postman::LOC_REQUEST:
@@ -113,31 +381,24 @@ int handle_request(Postman &postman, Postman::Request &req)
 
 		case Postman::NEW_SERVER_EXECUTE:
 		{
-			NameService::Names all_names = ns.get_all_names();
-			NameService::Names::iterator it;
-
-			for(it = all_names.begin(); it != all_names.end(); it++)
-			{
-				Name &n = *it;
-				ScopedConnection conn(postman, n.ip, n.port);
-				int remote_fd = conn.get_fd();
-
-				if(remote_fd < 0)
-				{
-					// remote server is dead
-					unsigned remote_id;
-
-					if(ns.resolve(n, remote_id) >= 0)
-					{
-						// remove it ... though not really needed to do so
-						ns.kill(remote_id);
-					}
-
-					continue;
-				} // otherwise connection has been established
+			// in parallel; the other workers keep serving lookups meanwhile
+			ExecuteBroadcast broadcast = { postman, liveness };
+			size_t num_skipped = fan_out(ns.get_all_names(), &new_server_execute_job, &broadcast,
+			                             BROADCAST_THREADS, now_ms() + broadcast_timeout_ms());
+			(void) num_skipped;
+#ifndef NDEBUG
+			std::cout << "NEW_SERVER_EXECUTE skipped " << num_skipped << " servers" << std::endl;
+#endif
+			// the sender doesn't wait for a reply
+			return OK;
+		}
 
-				postman.send_new_server_execute(remote_fd);
-			}
+		case Postman::HEARTBEAT:
+		{
+			unsigned remote_id = pop_i32(ss);
+			// remember the control connection, so the server is declared dead as soon as it closes
+			liveness.heard_from(remote_id, remote_fd, req.conn_id);
+			return OK;
 		}
 
 		case Postman::CONFIRM_TERMINATE:
@@ -147,6 +408,13 @@ int handle_request(Postman &postman, Postman::Request &req)
 		case Postman::ASK_NS_UPDATE:
 			return postman.reply_ns_update(remote_fd, remote_ns_version);
 
+		case Postman::WATCH:
+			watchers.add(remote_fd, req.conn_id, remote_ns_version);
+			return OK;
+
+		case Postman::STATS:
+			return postman.reply_stats(remote_fd);
+
 		default:
 			// not applicable; drop request
 			return 1;
@@ -161,30 +429,106 @@ int main()
 {
 	NameService ns;
 	Postman postman(ns);
-	int fd = postman.bind_and_listen();
+	// the name directory and ids survive a restart if there is a state file
+	Journal journal;
+	const char *state_file = getenv("BINDER_STATE_FILE");
+
+	if(state_file != NULL)
+	{
+		int retval = journal.open(state_file, ns);
+
+		if(retval < 0)
+		{
+			std::cerr << "cannot recover from " << state_file << ": " << retval << std::endl;
+			return 1;
+		}
+	}
+
+	// a restarted binder should listen on its old port, so servers and clients find it again
+	int fd = postman.bind_and_listen(get_env_long("BINDER_LISTEN_PORT", 0));
 	print_host_info(fd,"BINDER");
+	// servers that miss their heartbeats are removed from the name directory
+	Liveness liveness(ns, postman, get_env_long("BINDER_HEARTBEAT_TIMEOUT", HEARTBEAT_TIMEOUT));
+	// clients (and standby binders) that want directory changes pushed to them
+	Watchers watchers(postman);
+	// every change is persisted before it is pushed to watchers
+	ns.add_listener(&journal);
+	ns.add_listener(&watchers);
+
+	// a standby replicates the primary's name directory by watching it, serves lookups,
+	// and takes over once the primary goes away (or a server couldn't reach it)
+	const char *primary_hostname = getenv("BINDER_PRIMARY_ADDRESS");
+	int primary_fd = -1;
+	unsigned primary_conn_id = 0;
+
+	if(primary_hostname != NULL)
+	{
+		primary_fd = postman.connect_remote(primary_hostname, get_env_long("BINDER_PRIMARY_PORT", 0));
+
+		if(primary_fd >= 0)
+		{
+			primary_conn_id = postman.get_conn_id(primary_fd);
+			postman.send_watch(primary_fd);
+		}
+	}
+
+	if(primary_fd < 0)
+	{
+		// recovered servers get a full timeout to reconnect and send a heartbeat
+		watch_all(ns, liveness);
+	}
+
+	// this thread is the reactor: it only receives requests and hands them to the workers
+	Workers workers(postman, journal, liveness, watchers);
 
 	while(true)
 	{
 		Postman::Request req;
+		// directory changes go out from here, never under the directory's lock
+		watchers.push_pending();
 
-		// receive_any call sync()
-		if(postman.sync_and_receive_any(req) >= 0)
+		// receive_any call sync(); returns early so the pushes above keep up
+		if(postman.poll_and_receive_any(req, 1000) >= 0)
 		{
 #ifndef NDEBUG
 			debug_print_type(req);
 #endif
+			bool is_from_primary = primary_fd >= 0 && req.fd == primary_fd;
+
+			if(is_from_primary && req.message.msg_type == Postman::NS_UPDATE_SENT)
+			{
+				// replicated in order, on this thread only
+				std::stringstream ss(req.message.str);
+				ns.apply_logs(ss);
+				continue;
+			}
+
+			if(!is_from_primary && primary_fd >= 0 && is_write(req))
+			{
+				take_over(postman, liveness, primary_fd, primary_conn_id);
+			}
 
 			if(req.message.msg_type == Postman::TERMINATE)
 			{
+				// finish whatever has been received, then broadcast from this thread only
+				workers.terminate();
+				liveness.terminate();
 				terminate_servers(postman);
+				// so a binder started from the state file doesn't wait for them
+				kill_all(ns);
+				watchers.terminate();
 				break;
 			}
 
-			int retval = handle_request(postman, req);
-			(void) retval;
-			// otherwise there's a bug... or something hasn't been implemented
-			assert(retval >= 0);
+			if(!is_from_primary)
+			{
+				workers.push(req);
+			}
+		}
+
+		if(primary_fd >= 0 && !postman.is_alive(primary_fd, primary_conn_id))
+		{
+			take_over(postman, liveness, primary_fd, primary_conn_id);
 		}
 	}
 }
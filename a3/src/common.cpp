@@ -58,6 +58,140 @@ int get_peer_info(int fd, Name &ret)
 	return OK;
 }
 
+long now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+long now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+void deadline_after(long ms, struct timespec &ret)
+{
+	clock_gettime(CLOCK_REALTIME, &ret);
+	ret.tv_sec += ms / 1000;
+	ret.tv_nsec += (ms % 1000) * 1000000;
+
+	if(ret.tv_nsec >= 1000000000)
+	{
+		ret.tv_sec++;
+		ret.tv_nsec -= 1000000000;
+	}
+}
+
+long get_env_long(const char *env_name, long default_val)
+{
+	const char *str = getenv(env_name);
+
+	if(str == NULL)
+	{
+		return default_val;
+	}
+
+	char *end;
+	long ret = strtol(str, &end, 10);
+	return (end == str || *end != '\0' || ret < 0) ? default_val : ret;
+}
+
+int get_cpu_list(const char *env_name, cpu_set_t &ret)
+{
+	const char *str = getenv(env_name);
+
+	if(str == NULL)
+	{
+		// no placement requested -- let the scheduler decide
+		CPU_ZERO(&ret);
+		return 0;
+	}
+
+	return parse_cpu_list(str, ret);
+}
+
+int parse_cpu_list(const char *str, cpu_set_t &ret)
+{
+	CPU_ZERO(&ret);
+	std::stringstream ss(str);
+
+	for(std::string range; std::getline(ss, range, ',');)
+	{
+		if(range.empty())
+		{
+			continue;
+		}
+
+		const char *begin = range.c_str();
+		char *end;
+		long first = strtol(begin, &end, 10);
+		long last = first;
+
+		if(end == begin)
+		{
+			return INVALID_CPU_LIST;
+		}
+
+		if(*end == '-')
+		{
+			begin = end + 1;
+			last = strtol(begin, &end, 10);
+
+			if(end == begin)
+			{
+				return INVALID_CPU_LIST;
+			}
+		}
+
+		if(*end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE)
+		{
+			return INVALID_CPU_LIST;
+		}
+
+		for(long cpu = first; cpu <= last; cpu++)
+		{
+			CPU_SET(cpu, &ret);
+		}
+	}
+
+	return CPU_COUNT(&ret);
+}
+
+int nth_cpu(const cpu_set_t &cpus, int n)
+{
+	for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if(CPU_ISSET(cpu, &cpus) && n-- == 0)
+		{
+			return cpu;
+		}
+	}
+
+	// n is out of range
+	assert(false);
+	return UNREACHABLE;
+}
+
+int pin_thread(pthread_t thread, const cpu_set_t &cpus)
+{
+	if(CPU_COUNT(&cpus) == 0)
+	{
+		// nothing to pin to
+		return OK;
+	}
+
+	if(pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpus) != 0)
+	{
+		// e.g. none of the cpus are online or allowed by the cgroup
+		return INVALID_CPU_LIST;
+	}
+
+	return OK;
+}
+
 void push_i32(std::stringstream &ss, int val)
 {
 	val = htonl(val);
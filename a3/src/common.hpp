@@ -3,6 +3,7 @@
 
 #include "config.hpp"
 #include <pthread.h>
+#include <sched.h>
 #include <sstream>
 #include <string>
 
@@ -39,6 +40,10 @@ enum ErrorNo
 	SKELETON_IS_NULL            =  -22,
 	SERVER_HAS_NO_AVAIL_THREADS =  -23,
 	TERMINATING                 =  -24,
+	INVALID_CPU_LIST            =  -25,
+	CANNOT_OPEN_STATE_FILE      =  -26,
+	STATE_FILE_CORRUPTED        =  -27,
+	CONNECT_TIMED_OUT           =  -28,
 	UNREACHABLE                 = -100
 };
 
@@ -58,6 +63,24 @@ void print_host_info(int fd, const char *prefix);
 
 int get_peer_info(int fd, Name &ret);
 
+// monotonic clock, in milliseconds
+long now_ms();
+// the same clock in microseconds
+long now_us();
+
+// absolute CLOCK_REALTIME deadline, e.g. for sem_timedwait()
+void deadline_after(long ms, struct timespec &ret);
+
+// read a non-negative integer from the environment, or use default_val if unset or malformed
+long get_env_long(const char *env_name, long default_val);
+
+// thread placement; cpu lists look like "0,2-5" (same as taskset -c)
+// returns the number of cpus in ret, or INVALID_CPU_LIST; an unset variable gives an empty set
+int get_cpu_list(const char *env_name, cpu_set_t &ret);
+int parse_cpu_list(const char *str, cpu_set_t &ret);
+int nth_cpu(const cpu_set_t &cpus, int n);
+int pin_thread(pthread_t thread, const cpu_set_t &cpus);
+
 // buffer-related helpers
 char pop_i8(std::stringstream &ss);
 int pop_i32(std::stringstream &ss);
@@ -4,4 +4,36 @@
 #define MAX_FUNC_NAME_LEN 63
 #define MAX_THREADS 20
 
+// binder worker threads
+#define BINDER_THREADS 8
+
+// NameService keeps at least NS_LOG_TAIL (and fewer than 2 * NS_LOG_TAIL) log entries;
+// peers that are further behind get a snapshot of the name directory instead
+#define NS_LOG_TAIL 64
+
+// defaults for failure detection, in milliseconds; servers read RPC_HEARTBEAT_INTERVAL
+// and the binder reads BINDER_HEARTBEAT_TIMEOUT to override them
+#define HEARTBEAT_INTERVAL 1000
+#define HEARTBEAT_TIMEOUT 5000
+
+// how long (in milliseconds) rpcCall reuses the binder's answer for a function instead of asking
+// again: a server for LOCATION_TTL, an error such as NO_AVAILABLE_SERVER for NO_SERVER_TTL;
+// clients read RPC_LOCATION_TTL and RPC_NO_SERVER_TTL to override them (0 disables caching);
+// a cached answer keeps all the function's servers, and the client takes turns among them itself
+#define LOCATION_TTL 1000
+#define NO_SERVER_TTL 100
+
+// the binder contacts servers (NEW_SERVER_EXECUTE and TERMINATE broadcasts) on up to
+// BROADCAST_THREADS threads, and gives up after BROADCAST_TIMEOUT milliseconds
+// (BINDER_BROADCAST_TIMEOUT overrides it)
+#define BROADCAST_THREADS 16
+#define BROADCAST_TIMEOUT 3000
+
+// the binder's state file (see Journal) is rewritten as a checkpoint after this many records
+#define JOURNAL_CHECKPOINT_EVERY 1024
+#define JOURNAL_INITIAL_SIZE (64 * 1024)
+
+// bytes of pushed directory changes that a watcher can leave unread before the binder disconnects it
+#define WATCHER_MAX_BACKLOG (1024 * 1024)
+
 #endif
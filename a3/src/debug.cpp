@@ -6,66 +6,68 @@
 #include <iostream>
 #include <sstream>
 
-void debug_print_type(const Postman::Request &req)
+const char *message_type_name(int msg_type)
 {
-	std::string temp;
-
-	switch(req.message.msg_type)
+	switch(msg_type)
 	{
 		case Postman::I_AM_SERVER:
-			temp = "Request: I_AM_SERVER";
-			break;
+			return "I_AM_SERVER";
 
 		case Postman::ASK_NS_UPDATE:
-			temp = "Request: ASK_NS_UPDATE";
-			break;
+			return "ASK_NS_UPDATE";
 
 		case Postman::SERVER_OK:
-			temp = "Request: SERVER_OK";
-			break;
+			return "SERVER_OK";
 
 		case Postman::NS_UPDATE_SENT:
-			temp = "Request: NS_UPDATE_SENT";
-			break;
+			return "NS_UPDATE_SENT";
 
 		case Postman::REGISTER:
-			temp = "Request: REGISTER";
-			break;
+			return "REGISTER";
 
 		case Postman::REGISTER_DONE:
-			temp = "Request: REGISTER_DONE";
-			break;
+			return "REGISTER_DONE";
 
 		case Postman::LOC_REQUEST:
-			temp = "Request: LOC_REQUEST";
-			break;
+			return "LOC_REQUEST";
 
 		case Postman::LOC_REPLY:
-			temp="Request: LOC_REPLY";
-			break;
+			return "LOC_REPLY";
 
 		case Postman::EXECUTE:
-			temp = "Request: EXECUTE";
-			break;
+			return "EXECUTE";
 
 		case Postman::EXECUTE_REPLY:
-			temp = "Request: EXECUTE_REPLY";
-			break;
+			return "EXECUTE_REPLY";
 
 		case Postman::CONFIRM_TERMINATE:
-			temp = "Request: CONFIRM_TERMINATE";
-			break;
+			return "CONFIRM_TERMINATE";
 
 		case Postman::NEW_SERVER_EXECUTE:
-			temp = "Request: NEW_SERVER_EXECUTE";
-			break;
+			return "NEW_SERVER_EXECUTE";
 
 		case Postman::TERMINATE:
-			temp = "Request: TERMINATE";
-			break;
+			return "TERMINATE";
+
+		case Postman::HEARTBEAT:
+			return "HEARTBEAT";
+
+		case Postman::WATCH:
+			return "WATCH";
+
+		case Postman::STATS:
+			return "STATS";
+
+		case Postman::STATS_REPLY:
+			return "STATS_REPLY";
 	}
 
-	std::cout << temp << std::endl;
+	return "UNKNOWN";
+}
+
+void debug_print_type(const Postman::Request &req)
+{
+	std::cout << "Request: " << message_type_name(req.message.msg_type) << std::endl;
 }
 
 std::string format_arg(int arg_type)
@@ -7,6 +7,7 @@ struct Function;
 struct Name;
 
 std::string format_arg(int arg_type);
+const char *message_type_name(int msg_type);
 void debug_print_type(const Postman::Request &req);
 void print_function(const Function &func);
 std::string to_ipv4_string(int bin);
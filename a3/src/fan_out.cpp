@@ -0,0 +1,80 @@
+#include "common.hpp"
+#include "fan_out.hpp"
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+// shared by the threads of one fan_out() call
+struct FanOut
+{
+	const NameService::Names &names;
+	FanOutJob job;
+	void *data;
+	long deadline_ms;
+	size_t next; // the next name to start
+	size_t num_skipped;
+	pthread_mutex_t mutex;
+
+	FanOut(const NameService::Names &names, FanOutJob job, void *data, long deadline_ms)
+		: names(names), job(job), data(data), deadline_ms(deadline_ms), next(0), num_skipped(0)
+	{
+		int retval = pthread_mutex_init(&this->mutex, NULL);
+		(void) retval;
+		assert(retval == 0);
+	}
+
+	~FanOut()
+	{
+		pthread_mutex_destroy(&this->mutex);
+	}
+};
+
+static void *run_fan_out(void *data)
+{
+	FanOut &fan = *static_cast<FanOut*>(data);
+
+	while(true)
+	{
+		size_t i;
+		{
+			ScopedLock lock(fan.mutex);
+
+			if(fan.next == fan.names.size())
+			{
+				break;
+			}
+
+			i = fan.next++;
+
+			if(now_ms() >= fan.deadline_ms)
+			{
+				fan.num_skipped++;
+				continue;
+			}
+		}
+		fan.job(fan.data, fan.names[i], fan.deadline_ms);
+	}
+
+	return NULL;
+}
+
+size_t fan_out(const NameService::Names &names, FanOutJob job, void *data, int max_threads, long deadline_ms)
+{
+	FanOut fan(names, job, data, deadline_ms);
+	size_t num_threads = std::min(static_cast<size_t>(std::max(max_threads, 1)), names.size());
+	std::vector<pthread_t> threads(num_threads);
+
+	for(size_t i = 0; i < num_threads; i++)
+	{
+		int retval = pthread_create(&threads[i], NULL, &run_fan_out, static_cast<void*>(&fan));
+		(void) retval;
+		assert(retval == 0);
+	}
+
+	for(size_t i = 0; i < num_threads; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	return fan.num_skipped;
+}
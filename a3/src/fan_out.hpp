@@ -0,0 +1,16 @@
+#ifndef _fan_out_hpp_
+#define _fan_out_hpp_
+
+#include "name_service.hpp"
+
+/*
+	Runs job once per server on up to max_threads threads, for the binder's broadcasts.
+	deadline_ms is an absolute now_ms(); jobs that haven't started by then are skipped,
+	and a job should bound its own blocking calls with it (e.g. the connect timeout of
+	Postman::connect_remote). Blocks until every started job has returned.
+	Returns the number of skipped servers.
+*/
+typedef void (*FanOutJob)(void *data, const Name &name, long deadline_ms);
+size_t fan_out(const NameService::Names &names, FanOutJob job, void *data, int max_threads, long deadline_ms);
+
+#endif
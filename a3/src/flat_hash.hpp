@@ -0,0 +1,208 @@
+#ifndef _flat_hash_hpp_
+#define _flat_hash_hpp_
+
+#include <cassert>
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+// finalizer of murmur3; spreads the bits of integer keys so linear probing works
+struct IntHasher
+{
+	size_t operator()(uint64_t key) const
+	{
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdULL;
+		key ^= key >> 33;
+		key *= 0xc4ceb9fe1a85ec53ULL;
+		key ^= key >> 33;
+		return static_cast<size_t>(key);
+	}
+};
+
+// open addressing hash table with linear probing
+// all slots live in one vector, so lookups touch one or two cache lines
+// erase leaves a tombstone, so it is safe to erase while walking over the slots
+template <typename Key, typename Value, typename Hasher>
+class FlatHash
+{
+private: // typedefs
+	enum SlotState
+	{
+		EMPTY,
+		USED,
+		DELETED
+	};
+
+	struct Slot
+	{
+		Key key;
+		Value value;
+		char state;
+	};
+private: // data
+	std::vector<Slot> slots; // the size is zero or a power of two
+	size_t num_used;
+	size_t num_deleted;
+	Hasher hasher;
+private: // methods
+	// returns the slot holding key, or the slot key should be inserted into
+	size_t probe(const Key &key) const
+	{
+		size_t mask = this->slots.size() - 1;
+		size_t i = this->hasher(key) & mask;
+		size_t first_deleted = this->slots.size();
+
+		while(this->slots[i].state != EMPTY)
+		{
+			if(this->slots[i].state == USED && this->slots[i].key == key)
+			{
+				return i;
+			}
+
+			if(this->slots[i].state == DELETED && first_deleted == this->slots.size())
+			{
+				first_deleted = i;
+			}
+
+			i = (i + 1) & mask;
+		}
+
+		return first_deleted == this->slots.size() ? i : first_deleted;
+	}
+
+	void rehash(size_t capacity)
+	{
+		std::vector<Slot> old;
+		old.swap(this->slots);
+		Slot empty;
+		empty.state = EMPTY;
+		this->slots.assign(capacity, empty);
+		this->num_used = 0;
+		this->num_deleted = 0;
+
+		for(size_t i = 0; i < old.size(); i++)
+		{
+			if(old[i].state == USED)
+			{
+				(*this)[old[i].key] = old[i].value;
+			}
+		}
+	}
+public: // methods
+	FlatHash()
+		: num_used(0)
+		, num_deleted(0)
+	{
+	}
+
+	size_t size() const
+	{
+		return this->num_used;
+	}
+
+	Value *find(const Key &key)
+	{
+		return const_cast<Value *>(static_cast<const FlatHash *>(this)->find(key));
+	}
+
+	const Value *find(const Key &key) const
+	{
+		if(this->slots.empty())
+		{
+			return NULL;
+		}
+
+		const Slot &slot = this->slots[this->probe(key)];
+		return slot.state == USED ? &slot.value : NULL;
+	}
+
+	// inserts a value-initialized Value if key is missing
+	// only an insertion can rehash, so slots stay put for keys that exist
+	Value &operator[](const Key &key)
+	{
+		if(!this->slots.empty())
+		{
+			Slot &slot = this->slots[this->probe(key)];
+
+			if(slot.state == USED)
+			{
+				return slot.value;
+			}
+		}
+
+		// keep the load (including tombstones) under 3/4
+		if((this->num_used + this->num_deleted + 1) * 4 > this->slots.size() * 3)
+		{
+			size_t capacity = this->slots.empty() ? 16 : this->slots.size();
+
+			while((this->num_used + 1) * 2 > capacity)
+			{
+				capacity *= 2;
+			}
+
+			this->rehash(capacity);
+		}
+
+		Slot &slot = this->slots[this->probe(key)];
+		assert(slot.state != USED);
+		this->num_deleted -= (slot.state == DELETED);
+		this->num_used++;
+		slot.key = key;
+		slot.value = Value();
+		slot.state = USED;
+		return slot.value;
+	}
+
+	bool erase(const Key &key)
+	{
+		if(this->slots.empty())
+		{
+			return false;
+		}
+
+		Slot &slot = this->slots[this->probe(key)];
+
+		if(slot.state != USED)
+		{
+			return false;
+		}
+
+		slot.state = DELETED;
+		slot.value = Value();
+		this->num_used--;
+		this->num_deleted++;
+		return true;
+	}
+
+	// walk over the slots with: for(i = 0; i < capacity(); i++) if(is_used(i)) ...
+	size_t capacity() const
+	{
+		return this->slots.size();
+	}
+
+	bool is_used(size_t i) const
+	{
+		return this->slots[i].state == USED;
+	}
+
+	const Key &key_at(size_t i) const
+	{
+		assert(this->is_used(i));
+		return this->slots[i].key;
+	}
+
+	Value &value_at(size_t i)
+	{
+		assert(this->is_used(i));
+		return this->slots[i].value;
+	}
+
+	const Value &value_at(size_t i) const
+	{
+		assert(this->is_used(i));
+		return this->slots[i].value;
+	}
+};
+
+#endif
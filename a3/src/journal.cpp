@@ -0,0 +1,252 @@
+#include "common.hpp"
+#include "journal.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef NDEBUG
+#include <iostream>
+#endif
+
+static const char JOURNAL_MAGIC[8] = { 'R', 'P', 'C', 'B', 'I', 'N', 'D', '1' };
+
+Journal::Journal()
+	: fd(-1),
+	  map(NULL),
+	  map_size(0),
+	  persisted_version(0),
+	  next_id_no_file(0)
+{
+	int retval = pthread_mutex_init(&this->mutex, NULL);
+	(void) retval;
+	assert(retval == 0);
+}
+
+Journal::~Journal()
+{
+	this->unmap_file();
+
+	if(this->fd >= 0)
+	{
+		close(this->fd);
+	}
+
+	pthread_mutex_destroy(&this->mutex);
+}
+
+Journal::Header &Journal::header()
+{
+	return *reinterpret_cast<Header*>(this->map);
+}
+
+// maps at least size bytes of fd (growing the file if needed) and sets size to what was mapped; NULL if it fails
+static char *map_fd(int fd, size_t &size)
+{
+	struct stat st;
+
+	if(fstat(fd, &st) < 0)
+	{
+		return NULL;
+	}
+
+	size = std::max(size, static_cast<size_t>(st.st_size));
+
+	if(static_cast<size_t>(st.st_size) < size && ftruncate(fd, size) < 0)
+	{
+		return NULL;
+	}
+
+	void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	return addr == MAP_FAILED ? NULL : static_cast<char*>(addr);
+}
+
+int Journal::map_file(size_t size)
+{
+	char *addr = map_fd(this->fd, size);
+
+	if(addr == NULL)
+	{
+		return CANNOT_OPEN_STATE_FILE;
+	}
+
+	this->unmap_file();
+	this->map = addr;
+	this->map_size = size;
+	return OK;
+}
+
+void Journal::unmap_file()
+{
+	if(this->map != NULL)
+	{
+		munmap(this->map, this->map_size);
+		this->map = NULL;
+		this->map_size = 0;
+	}
+}
+
+int Journal::open(const char *path, NameService &ns)
+{
+	ScopedLock lock(this->mutex);
+	assert(this->fd < 0);
+	this->path = path;
+	this->fd = ::open(path, O_RDWR | O_CREAT, 0644);
+
+	if(this->fd < 0 || this->map_file(JOURNAL_INITIAL_SIZE) < 0)
+	{
+		return CANNOT_OPEN_STATE_FILE;
+	}
+
+	Header &header = this->header();
+
+	if(header.end == 0)
+	{
+		// a new file
+		memcpy(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+		header.end = sizeof(Header);
+		header.next_id = 0;
+		header.num_records = 0;
+	}
+	else if(memcmp(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0 || header.end > this->map_size)
+	{
+		return STATE_FILE_CORRUPTED;
+	}
+
+	// replay; a record is its size followed by a log delta
+	uint64_t offset = sizeof(Header);
+
+	while(offset < header.end)
+	{
+		uint32_t size;
+
+		if(header.end - offset < sizeof(size))
+		{
+			return STATE_FILE_CORRUPTED;
+		}
+
+		memcpy(&size, this->map + offset, sizeof(size));
+		offset += sizeof(size);
+
+		if(header.end - offset < size)
+		{
+			return STATE_FILE_CORRUPTED;
+		}
+
+		std::stringstream ss(std::string(this->map + offset, size));
+		ns.apply_logs(ss);
+		offset += size;
+	}
+
+	this->persisted_version = ns.get_version();
+#ifndef NDEBUG
+	std::cout << "recovered name directory version:" << this->persisted_version
+	          << " next id:" << header.next_id << " from " << path << std::endl;
+#endif
+	return OK;
+}
+
+int Journal::append(const std::string &record)
+{
+	uint32_t size = record.size();
+	uint64_t end = this->header().end + sizeof(size) + size;
+
+	// should not fail unless the disk is full
+	if(end > this->map_size && this->map_file(std::max(static_cast<size_t>(end), this->map_size * 2)) < 0)
+	{
+		return CANNOT_OPEN_STATE_FILE;
+	}
+
+	Header &header = this->header();
+	memcpy(this->map + header.end, &size, sizeof(size));
+	memcpy(this->map + header.end + sizeof(size), record.data(), size);
+	// a crash before this leaves the record out instead of half written
+	__sync_synchronize();
+	header.end = end;
+	header.num_records++;
+	return OK;
+}
+
+int Journal::checkpoint(NameService &ns)
+{
+	// get_logs(0) has everything: a snapshot, or all entries if none were compacted yet
+	std::string record = ns.get_logs(0);
+	uint32_t size = record.size();
+	Header header = this->header();
+	header.end = sizeof(Header) + sizeof(size) + size;
+	header.num_records = 1;
+
+	// write a new file and rename it over the old one, so one of them is always complete
+	std::string tmp_path = this->path + ".tmp";
+	int tmp_fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+	if(tmp_fd < 0)
+	{
+		return CANNOT_OPEN_STATE_FILE;
+	}
+
+	// the new file is mapped before it replaces the old one, so a failure leaves the old one in use
+	size_t tmp_map_size = JOURNAL_INITIAL_SIZE;
+	char *tmp_map = NULL;
+
+	if(write(tmp_fd, &header, sizeof(header)) != sizeof(header)
+	        || write(tmp_fd, &size, sizeof(size)) != sizeof(size)
+	        || write(tmp_fd, record.data(), size) != static_cast<ssize_t>(size)
+	        || fsync(tmp_fd) < 0
+	        || (tmp_map = map_fd(tmp_fd, tmp_map_size)) == NULL
+	        || rename(tmp_path.c_str(), this->path.c_str()) < 0)
+	{
+		if(tmp_map != NULL)
+		{
+			munmap(tmp_map, tmp_map_size);
+		}
+
+		close(tmp_fd);
+		unlink(tmp_path.c_str());
+		return CANNOT_OPEN_STATE_FILE;
+	}
+
+	this->unmap_file();
+	close(this->fd);
+	this->fd = tmp_fd;
+	this->map = tmp_map;
+	this->map_size = tmp_map_size;
+#ifndef NDEBUG
+	std::cout << "checkpoint of name directory version:" << ns.get_version() << std::endl;
+#endif
+	return OK;
+}
+
+unsigned Journal::next_id(NameService &ns)
+{
+	ScopedLock lock(this->mutex);
+	// in the file before anyone sees it, so it is not handed out again after a restart
+	uint32_t &next = (this->fd < 0) ? this->next_id_no_file : this->header().next_id;
+	// a standby has only seen the ids in the logs it replicated
+	next = std::max(next, ns.get_id_floor());
+	return next++;
+}
+
+void Journal::published(NameService &ns)
+{
+	ScopedLock lock(this->mutex);
+	unsigned version = ns.get_version();
+
+	if(this->fd < 0 || version <= this->persisted_version)
+	{
+		return;
+	}
+
+	if((this->header().num_records < JOURNAL_CHECKPOINT_EVERY || this->checkpoint(ns) < 0)
+	        && this->append(ns.get_logs(this->persisted_version)) < 0)
+	{
+		// nothing was written; the next change tries again with these entries too
+		return;
+	}
+
+	this->persisted_version = version;
+}
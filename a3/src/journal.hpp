@@ -0,0 +1,62 @@
+#ifndef _journal_hpp_
+#define _journal_hpp_
+
+#include "name_service.hpp"
+#include <string>
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+	The binder's name directory (and its id counter) persisted in a memory-mapped,
+	append-only state file, so a restarted binder resumes with the same versions and ids
+	instead of waiting for every server to register again.
+	Each record is a log delta in the format of NameService::get_logs(); a checkpoint
+	rewrites the file as one record that holds the whole directory.
+	Without a state file nothing is persisted. All public methods are synchronized.
+*/
+class Journal : public NameService::Listener
+{
+private: // typedefs
+	struct Header
+	{
+		char magic[8];
+		uint64_t end; // offset just past the last complete record
+		uint32_t next_id;
+		uint32_t num_records; // since the last checkpoint
+	};
+
+private: // data
+	std::string path;
+	int fd; // -1 when there is no state file
+	char *map;
+	size_t map_size;
+	unsigned persisted_version;
+	uint32_t next_id_no_file;
+	pthread_mutex_t mutex;
+
+private: // methods
+	Header &header();
+	// maps at least size bytes of the file, growing it if needed; the old map stays if it fails
+	int map_file(size_t size);
+	void unmap_file();
+	// leaves the file as it was if it can't grow the map
+	int append(const std::string &record);
+	// replaces the file with a single record holding the whole directory
+	int checkpoint(NameService &ns);
+
+public: // methods
+	Journal();
+	~Journal();
+
+	// maps the state file (creating it if needed) and replays it into ns;
+	// call before ns is used and before adding the journal as a listener of ns
+	int open(const char *path, NameService &ns);
+
+	// unique ids for servers, never reused across restarts or by a standby that took over
+	unsigned next_id(NameService &ns);
+
+	// appends the entries since the last call
+	virtual void published(NameService &ns);
+};
+
+#endif
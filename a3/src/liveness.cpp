@@ -0,0 +1,139 @@
+#include "common.hpp"
+#include "liveness.hpp"
+#include "name_service.hpp"
+#include "postman.hpp"
+#include <algorithm>
+#include <cassert>
+#include <ctime>
+#include <vector>
+
+#ifndef NDEBUG
+#include <iostream>
+#endif
+
+void *run_monitor(void *data);
+
+Liveness::Liveness(NameService &ns, Postman &postman, long timeout_ms)
+	: ns(ns),
+	  postman(postman),
+	  timeout_ms(timeout_ms),
+	  is_terminate(false)
+{
+	// not going to check for errors
+	int retval;
+	(void) retval;
+	retval = pthread_mutex_init(&this->mutex, NULL);
+	assert(retval == 0);
+	retval = sem_init(&this->stop_sem, 0, 0);
+	assert(retval == 0);
+	retval = pthread_create(&this->monitor, NULL, &run_monitor, static_cast<void*>(this));
+	assert(retval == 0);
+}
+
+Liveness::~Liveness()
+{
+	// must call terminate() separately
+	assert(this->is_terminate);
+	pthread_mutex_destroy(&this->mutex);
+	sem_destroy(&this->stop_sem);
+}
+
+void Liveness::add(unsigned id)
+{
+	ScopedLock lock(this->mutex);
+	Entry entry = { now_ms(), -1, 0 };
+	this->entries[id] = entry;
+}
+
+void Liveness::heard_from(unsigned id, int fd, unsigned conn_id)
+{
+	ScopedLock lock(this->mutex);
+	Entries::iterator it = this->entries.find(id);
+
+	if(it == this->entries.end())
+	{
+		// already declared dead (or never registered) -- too late
+#ifndef NDEBUG
+		std::cout << "heartbeat from unknown id:" << id << std::endl;
+#endif
+		return;
+	}
+
+	it->second.last_heard = now_ms();
+	it->second.fd = fd;
+	it->second.conn_id = conn_id;
+}
+
+void Liveness::forget(unsigned id)
+{
+	ScopedLock lock(this->mutex);
+	this->entries.erase(id);
+}
+
+void Liveness::expire()
+{
+	std::vector<unsigned> dead;
+	{
+		ScopedLock lock(this->mutex);
+		long now = now_ms();
+		Entries::iterator it = this->entries.begin();
+
+		while(it != this->entries.end())
+		{
+			Entry &entry = it->second;
+			bool is_timed_out = now - entry.last_heard > this->timeout_ms;
+			bool is_closed = entry.fd >= 0 && !this->postman.is_alive(entry.fd, entry.conn_id);
+
+			if(is_timed_out || is_closed)
+			{
+				dead.push_back(it->first);
+				this->entries.erase(it++);
+			}
+			else
+			{
+				it++;
+			}
+		}
+	}
+
+	// don't hold the table while writing logs
+	for(size_t i = 0; i < dead.size(); i++)
+	{
+#ifndef NDEBUG
+		std::cout << "no heartbeat from id:" << dead[i] << std::endl;
+#endif
+		this->ns.kill(dead[i]);
+	}
+}
+
+void Liveness::terminate()
+{
+	assert(!this->is_terminate);
+	this->is_terminate = true;
+	sem_post(&this->stop_sem);
+	pthread_join(this->monitor, NULL);
+}
+
+void *run_monitor(void *data)
+{
+	Liveness &liveness = *static_cast<Liveness*>(data);
+	// closed control connections are cheap to check, so look often; a server that
+	// merely stops sending heartbeats is detected within ~1.25 * timeout
+	long period_ms = std::max(std::min(liveness.timeout_ms / 4, 100L), 1L);
+
+	while(true)
+	{
+		struct timespec deadline;
+		deadline_after(period_ms, deadline);
+
+		if(sem_timedwait(&liveness.stop_sem, &deadline) == 0)
+		{
+			// woken up by terminate()
+			break;
+		}
+
+		liveness.expire();
+	}
+
+	return NULL;
+}
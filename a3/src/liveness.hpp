@@ -0,0 +1,57 @@
+#ifndef _liveness_hpp_
+#define _liveness_hpp_
+
+#include <map>
+#include <pthread.h>
+#include <semaphore.h>
+
+class NameService;
+class Postman;
+
+/*
+	The binder's view of which servers are alive.
+	Servers send HEARTBEAT over a persistent control connection; a server is
+	considered dead (and killed in the name directory) when it hasn't been
+	heard from for timeout_ms, or as soon as its control connection closes.
+	All public methods are synchronized.
+*/
+class Liveness
+{
+private: // typedefs
+	struct Entry
+	{
+		long last_heard; // now_ms()
+		int fd; // control connection; -1 until the first heartbeat
+		unsigned conn_id;
+	};
+	typedef std::map<unsigned, Entry> Entries;
+
+private: // data
+	NameService &ns;
+	Postman &postman;
+	const long timeout_ms;
+	Entries entries;
+	pthread_t monitor;
+	pthread_mutex_t mutex;
+	sem_t stop_sem; // posted by terminate() to wake up the monitor
+	bool is_terminate;
+
+private: // methods
+	// kill every server that missed its deadline; called by the monitor thread
+	void expire();
+
+public: // methods
+	Liveness(NameService &ns, Postman &postman, long timeout_ms);
+	~Liveness();
+
+	// a new server gets timeout_ms to send its first heartbeat
+	void add(unsigned id);
+	void heard_from(unsigned id, int fd, unsigned conn_id);
+	void forget(unsigned id);
+
+	void terminate();
+
+	friend void *run_monitor(void *data);
+};
+
+#endif
@@ -0,0 +1,220 @@
+#include "common.hpp"
+#include "metrics.hpp"
+#include "postman.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+// fails to compile if NUM_TYPES doesn't cover the last Postman::MessageType
+typedef char num_types_check[Postman::STATS_REPLY == (1 << (Metrics::NUM_TYPES - 1)) ? 1 : -1];
+
+// a shard is only written by its thread, but get() reads it from another one
+static void bump(uint64_t &counter, uint64_t by)
+{
+	__atomic_store_n(&counter, __atomic_load_n(&counter, __ATOMIC_RELAXED) + by, __ATOMIC_RELAXED);
+}
+
+static uint64_t load(const uint64_t &counter)
+{
+	return __atomic_load_n(&counter, __ATOMIC_RELAXED);
+}
+
+static void add(Metrics::Counters &to, const Metrics::Counters &from)
+{
+	to.msgs_in += load(from.msgs_in);
+	to.msgs_out += load(from.msgs_out);
+	to.bytes_in += load(from.bytes_in);
+	to.bytes_out += load(from.bytes_out);
+
+	for(size_t i = 0; i < Metrics::NUM_BUCKETS; i++)
+	{
+		to.wait_us[i] += load(from.wait_us[i]);
+	}
+}
+
+Metrics::Metrics()
+{
+	int retval = pthread_key_create(&this->key, &Metrics::retire);
+	(void) retval;
+	assert(retval == 0);
+	retval = pthread_mutex_init(&this->mutex, NULL);
+	assert(retval == 0);
+	memset(&this->retired, 0, sizeof(this->retired));
+}
+
+Metrics::~Metrics()
+{
+	// no more retire() calls after this
+	pthread_key_delete(this->key);
+
+	for(size_t i = 0; i < this->shards.size(); i++)
+	{
+		delete this->shards[i];
+	}
+
+	pthread_mutex_destroy(&this->mutex);
+}
+
+Metrics::Shard *Metrics::shard()
+{
+	Shard *ret = static_cast<Shard*>(pthread_getspecific(this->key));
+
+	if(ret == NULL)
+	{
+		// first update from this thread
+		ret = new Shard;
+		memset(ret, 0, sizeof(*ret));
+		ret->owner = this;
+		pthread_setspecific(this->key, ret);
+		ScopedLock lock(this->mutex);
+		this->shards.push_back(ret);
+	}
+
+	return ret;
+}
+
+// called when a thread that has a shard exits, so short-lived threads (e.g. fan_out) don't pile up
+void Metrics::retire(void *data)
+{
+	Shard *shard = static_cast<Shard*>(data);
+	Metrics &metrics = *shard->owner;
+	ScopedLock lock(metrics.mutex);
+
+	for(size_t i = 0; i < NUM_TYPES; i++)
+	{
+		add(metrics.retired.types[i], shard->types[i]);
+	}
+
+	metrics.shards.erase(std::find(metrics.shards.begin(), metrics.shards.end(), shard));
+	delete shard;
+}
+
+void Metrics::received(int msg_type, size_t bytes)
+{
+	int i = get_type_index(msg_type);
+
+	if(i >= 0)
+	{
+		Counters &counters = this->shard()->types[i];
+		bump(counters.msgs_in, 1);
+		bump(counters.bytes_in, bytes);
+	}
+}
+
+void Metrics::sent(int msg_type, size_t bytes)
+{
+	int i = get_type_index(msg_type);
+
+	if(i >= 0)
+	{
+		Counters &counters = this->shard()->types[i];
+		bump(counters.msgs_out, 1);
+		bump(counters.bytes_out, bytes);
+	}
+}
+
+void Metrics::waited(int msg_type, long wait_us)
+{
+	int i = get_type_index(msg_type);
+
+	if(i >= 0)
+	{
+		bump(this->shard()->types[i].wait_us[get_bucket(wait_us)], 1);
+	}
+}
+
+void Metrics::get(Snapshot &ret)
+{
+	memset(&ret, 0, sizeof(ret));
+	ScopedLock lock(this->mutex);
+
+	for(size_t i = 0; i < NUM_TYPES; i++)
+	{
+		add(ret.types[i], this->retired.types[i]);
+
+		for(size_t j = 0; j < this->shards.size(); j++)
+		{
+			add(ret.types[i], this->shards[j]->types[i]);
+		}
+	}
+}
+
+int get_type_index(int msg_type)
+{
+	for(int i = 0; i < Metrics::NUM_TYPES; i++)
+	{
+		if(msg_type == (1 << i))
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+size_t get_bucket(long wait_us)
+{
+	size_t ret = 0;
+
+	while(wait_us > 0 && ret + 1 < Metrics::NUM_BUCKETS)
+	{
+		wait_us >>= 1;
+		ret++;
+	}
+
+	return ret;
+}
+
+void push(std::stringstream &ss, const Metrics::Snapshot &snapshot)
+{
+	push_i32(ss, snapshot.incoming_depth);
+	push_i32(ss, snapshot.incoming_max_depth);
+	push_i32(ss, snapshot.outgoing_depth);
+	push_i32(ss, Metrics::NUM_TYPES);
+	push_i32(ss, Metrics::NUM_BUCKETS);
+
+	for(size_t i = 0; i < Metrics::NUM_TYPES; i++)
+	{
+		const Metrics::Counters &counters = snapshot.types[i];
+		push_i64(ss, counters.msgs_in);
+		push_i64(ss, counters.msgs_out);
+		push_i64(ss, counters.bytes_in);
+		push_i64(ss, counters.bytes_out);
+
+		for(size_t j = 0; j < Metrics::NUM_BUCKETS; j++)
+		{
+			push_i64(ss, counters.wait_us[j]);
+		}
+	}
+}
+
+void snapshot_from_sstream(std::stringstream &ss, Metrics::Snapshot &ret)
+{
+	memset(&ret, 0, sizeof(ret));
+	ret.incoming_depth = pop_i32(ss);
+	ret.incoming_max_depth = pop_i32(ss);
+	ret.outgoing_depth = pop_i32(ss);
+	// a peer built with other sizes still reads correctly; extra types or buckets are dropped
+	size_t num_types = pop_i32(ss);
+	size_t num_buckets = pop_i32(ss);
+
+	for(size_t i = 0; i < num_types; i++)
+	{
+		Metrics::Counters counters;
+		memset(&counters, 0, sizeof(counters));
+		counters.msgs_in = pop_i64(ss);
+		counters.msgs_out = pop_i64(ss);
+		counters.bytes_in = pop_i64(ss);
+		counters.bytes_out = pop_i64(ss);
+
+		for(size_t j = 0; j < num_buckets; j++)
+		{
+			counters.wait_us[std::min(j, static_cast<size_t>(Metrics::NUM_BUCKETS - 1))] += pop_i64(ss);
+		}
+
+		if(i < Metrics::NUM_TYPES)
+		{
+			ret.types[i] = counters;
+		}
+	}
+}
@@ -0,0 +1,71 @@
+#ifndef _metrics_hpp_
+#define _metrics_hpp_
+
+#include <sstream>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+	Message counters and latency histograms of a Postman, per message type.
+	Each thread updates its own shard without locking (relaxed atomic stores); get() adds
+	the shards up, so a reader may miss the updates that are in flight.
+*/
+class Metrics
+{
+public: // typedefs
+	enum
+	{
+		NUM_TYPES = 18, // Postman::MessageType flags are 1 << index; metrics.cpp checks it against the last one
+		NUM_BUCKETS = 32
+	};
+	struct Counters
+	{
+		uint64_t msgs_in, msgs_out, bytes_in, bytes_out;
+		// time between read_avail() and receive_any(); bucket 0 counts waits under
+		// 1 microsecond, and bucket i counts [2^(i-1), 2^i) microseconds
+		uint64_t wait_us[NUM_BUCKETS];
+	};
+	struct Snapshot
+	{
+		Counters types[NUM_TYPES];
+		uint32_t incoming_depth, incoming_max_depth, outgoing_depth;
+	};
+
+private: // typedefs
+	struct Shard
+	{
+		Metrics *owner;
+		Counters types[NUM_TYPES];
+	};
+
+private: // data
+	pthread_key_t key;
+	std::vector<Shard*> shards;
+	Shard retired; // the counts of the threads that have exited
+	pthread_mutex_t mutex;
+
+private: // methods
+	Shard *shard();
+	static void retire(void *shard);
+
+public: // methods
+	Metrics();
+	~Metrics();
+
+	void received(int msg_type, size_t bytes);
+	void sent(int msg_type, size_t bytes);
+	void waited(int msg_type, long wait_us);
+
+	// the sum of all threads; the caller fills in the queue depths
+	void get(Snapshot &ret);
+};
+
+// Postman::MessageType to its index in Snapshot::types, or -1 if it isn't a single known flag
+int get_type_index(int msg_type);
+size_t get_bucket(long wait_us);
+
+void push(std::stringstream &ss, const Metrics::Snapshot &snapshot);
+void snapshot_from_sstream(std::stringstream &ss, Metrics::Snapshot &ret);
+
+#endif
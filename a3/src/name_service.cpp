@@ -2,6 +2,7 @@
 #include "name_service.hpp"
 #include "rpc.h"
 #include <cassert>
+#include <sched.h>
 
 #ifndef NDEBUG
 #include <iostream>
@@ -12,8 +13,18 @@
 static NameService::LogEntry pop_entry(std::stringstream &ss);
 static void push(std::stringstream &ss, const NameService::LogEntry &entry);
 
+// the key of a Name in LeftMap
+static uint64_t name_key(const Name &name)
+{
+	return (static_cast<uint64_t>(static_cast<unsigned>(name.ip)) << 32) | static_cast<unsigned>(name.port);
+}
+
 NameService::NameService()
+	: current(new Directory())
+	, epoch(0)
 {
+	this->readers[0] = 0;
+	this->readers[1] = 0;
 	int retval = pthread_mutex_init(&this->mutex, NULL);
 	(void) retval;
 	assert(retval == 0);
@@ -21,113 +32,202 @@ NameService::NameService()
 
 NameService::~NameService()
 {
+	delete this->current;
 	pthread_mutex_destroy(&this->mutex);
 }
 
-int NameService::suggest_helper(Postman &postman, const Function &func, unsigned &ret, bool is_binder)
+const NameService::Directory &NameService::read_begin(unsigned &epoch)
 {
-	NameIdsWithPivot &pair = this->func_to_ids[func];
-	NameIds &ids = pair.first;
-#ifndef NDEBUG
-	print_function(func);
-#endif
-
-	if(ids.size() == 0)
+	while(true)
 	{
-		// no suggestion
-		return NO_AVAILABLE_SERVER;
+		epoch = this->epoch;
+		// full barrier; the writer either sees us in readers[] or we see its new epoch
+		__sync_fetch_and_add(&this->readers[epoch & 1], 1);
+
+		if(epoch == this->epoch)
+		{
+			return *this->current;
+		}
+
+		// a writer flipped the epoch in between, so it may not wait for us
+		__sync_fetch_and_sub(&this->readers[epoch & 1], 1);
 	}
+}
+
+void NameService::read_end(unsigned epoch)
+{
+	__sync_fetch_and_sub(&this->readers[epoch & 1], 1);
+}
+
+NameService::Directory *NameService::copy_current() const
+{
+	return new Directory(*this->current);
+}
 
-	// update the pivot
-	int next = (pair.second + 1) % ids.size();
-	// get the k-th element (pivot)
-	NameIds::iterator it = ids.begin();
-	std::advance(it, next);
-	// pivot is between [0,ids.size()]; therefore it must point to something
-	assert(it != ids.end());
-	// test if the server is still alive
-	Name name;
-	int id = *it;
+NameService::Directory::Directory()
+	: base_version(0)
+	, id_floor(0)
+{
+}
 
-	// if a function is registered under an id, the id must have existed...
-	if(this->resolve_helper(id, name) < 0)
+NameService::Directory::Directory(const Directory &other)
+	: name_to_id(other.name_to_id)
+	, id_to_name(other.id_to_name)
+	, func_to_ids(other.func_to_ids)
+	, logs(other.logs)
+	, base_version(other.base_version)
+	, id_floor(other.id_floor)
+{
+	// the lists are shared until one of the directories changes them
+	for(size_t i = 0; i < this->func_to_ids.capacity(); i++)
 	{
-		// this happens when the name entry is cleaned up by other suggest() call for a different function, which cleaned up zombie name entries
-		// remove this candadate
-		ids.erase(id);
-		// recurse with one less candidate
-		return suggest_helper(postman, func, ret, is_binder);
+		if(this->func_to_ids.is_used(i))
+		{
+			this->func_to_ids.value_at(i)->refs++;
+		}
 	}
+}
 
+NameService::Directory::~Directory()
+{
+	for(size_t i = 0; i < this->func_to_ids.capacity(); i++)
 	{
-		ScopedConnection conn(postman, name.ip, name.port);
-
-		if(conn.get_fd() >= 0)
+		if(this->func_to_ids.is_used(i) && --this->func_to_ids.value_at(i)->refs == 0)
 		{
-#ifndef NDEBUG
-			std::cout << "suggestion for func:" << func.name << " to id:" << id << std::endl;
-#endif
-			pair.second = next;
-			// bingo! this server is still alive
-			ret = id;
-			return OK;
+			delete this->func_to_ids.value_at(i);
 		}
 	}
+}
+
+NameService::NameIdsWithPivot &NameService::Directory::get_writable(const Function &func)
+{
+	NameIdsWithPivot *&list = this->func_to_ids[func];
+
+	if(list == NULL)
+	{
+		list = new NameIdsWithPivot();
+		list->pivot = 0;
+		list->refs = 1;
+	}
+	else if(list->refs > 1)
+	{
+		// other directories (possibly being read) still use it
+		NameIdsWithPivot *copy = new NameIdsWithPivot(*list);
+		copy->refs = 1;
+		list->refs--;
+		list = copy;
+	}
+
+	return *list;
+}
 
-	// only "kill" the id if application is the binder
-	// otherwise the logs become inconsistent
-	if(is_binder)
+void NameService::publish(Directory *dir)
+{
+	Directory *old = this->current;
+	__sync_synchronize();
+	this->current = dir;
+	__sync_synchronize();
+	// readers registered in the old epoch may still use the old directory
+	unsigned old_epoch = this->epoch;
+	this->epoch = old_epoch + 1;
+	__sync_synchronize();
+
+	while(this->readers[old_epoch & 1] != 0)
 	{
-		// this server is not alive
-		this->kill_helper(id);
+		// readers never block, so this is short
+		sched_yield();
 	}
 
-	ids.erase(id);
-	// recurse with one less candidate
-	return this->suggest_helper(postman, func, ret, is_binder);
+	delete old;
+
+	for(size_t i = 0; i < this->listeners.size(); i++)
+	{
+		this->listeners[i]->published(*this);
+	}
 }
 
-int NameService::suggest(Postman &postman, const Function &func, unsigned &ret, bool is_binder)
+void NameService::add_listener(Listener *listener)
 {
-	ScopedLock lock(this->mutex);
-	return this->suggest_helper(postman, func, ret, is_binder);
+	this->listeners.push_back(listener);
+}
+
+int NameService::suggest(const Function &func, unsigned &ret)
+{
+#ifndef NDEBUG
+	print_function(func);
+#endif
+	unsigned epoch;
+	const Directory &dir = this->read_begin(epoch);
+	NameIdsWithPivot *const *list = dir.func_to_ids.find(func);
+
+	if(list == NULL)
+	{
+		// no suggestion
+		this->read_end(epoch);
+		return NO_AVAILABLE_SERVER;
+	}
+
+	// empty lists are removed from func_to_ids
+	const NameIds &ids = (*list)->ids;
+	assert(!ids.empty());
+	// update the pivot; racing readers may get the same server, which is harmless
+	unsigned pivot = __sync_fetch_and_add(&(*list)->pivot, 1) % ids.size();
+	// killed servers are removed from func_to_ids, so the id must exist
+	assert(dir.id_to_name.find(ids[pivot]) != NULL);
+	ret = ids[pivot];
+	this->read_end(epoch);
+#ifndef NDEBUG
+	std::cout << "suggestion for func:" << func.name << " to id:" << ret << std::endl;
+#endif
+	return OK;
 }
 
 NameService::Names NameService::get_all_names()
 {
 	Names names;
-	ScopedLock lock(this->mutex);
-	LeftMap::const_iterator it = this->name_to_id.begin();
+	unsigned epoch;
+	const Directory &dir = this->read_begin(epoch);
 
-	for(; it != this->name_to_id.end(); it++)
+	for(size_t i = 0; i < dir.id_to_name.capacity(); i++)
 	{
-		names.push_back(it->first);
+		if(dir.id_to_name.is_used(i))
+		{
+			names.push_back(dir.id_to_name.value_at(i));
+		}
 	}
 
+	this->read_end(epoch);
 	return names;
 }
 
 void NameService::register_fn(unsigned id, const Function &func)
 {
 	ScopedLock lock(this->mutex);
-	this->register_fn_helper(id, func);
+	Directory *dir = this->copy_current();
+	register_fn_helper(*dir, id, func);
+	this->publish(dir);
 }
 
-void NameService::register_fn_helper(unsigned id, const Function &func)
+void NameService::register_fn_helper(Directory &dir, unsigned id, const Function &func)
 {
 #ifndef NDEBUG
-	std::cout << "registering function for node id:" << id << " log#:" << (this->logs.size() + 1) << std::endl;
+	std::cout << "registering function for node id:" << id << " log#:" << (dir.get_version() + 1) << std::endl;
 	print_function(func);
 #endif
-	// insert the entry
-	NameIds &ids = this->func_to_ids[func].first;
-	ids.insert(id);
+	// insert the entry; a server may register the same function twice
+	NameIdsWithPivot &list = dir.get_writable(func);
+
+	if(list.positions.find(id) == NULL)
+	{
+		list.positions[id] = list.ids.size();
+		list.ids.push_back(id);
+	}
 	// add a log entry
 	std::stringstream ss;
 	push_i32(ss, id);
 	push(ss, func);
 	LogEntry entry = {NEW_FUNC, ss.str()};
-	this->logs.push_back(entry);
+	append_log(dir, entry);
 }
 
 void push(std::stringstream &ss, const Function &func)
@@ -158,89 +258,252 @@ Function func_from_sstream(std::stringstream &ss)
 	return func;
 }
 
-int NameService::resolve(unsigned id, Name &ret)
+void push_args(std::stringstream &ss, const Function &func, void **args, bool is_output)
 {
-	ScopedLock lock(this->mutex);
-	return this->resolve_helper(id, ret);
+	for(size_t i = 0; i < func.types.size(); i++)
+	{
+		int arg_type = func.types[i];
+		size_t cardinality = get_arg_car(arg_type);
+
+		if(is_output ? !is_arg_output(arg_type) : !is_arg_input(arg_type))
+		{
+			continue;
+		}
+
+		switch(get_arg_data_type(arg_type))
+		{
+			case ARG_CHAR:
+				for(size_t j = 0; j < cardinality; j++)
+				{
+					push_i8(ss, ((char*)args[i])[j]);
+				}
+
+				break;
+
+			case ARG_SHORT:
+				for(size_t j = 0; j < cardinality; j++)
+				{
+					push_i16(ss, ((short*)args[i])[j]);
+				}
+
+				break;
+
+			case ARG_INT:
+				for(size_t j = 0; j < cardinality; j++)
+				{
+					push_i32(ss, ((int*)args[i])[j]);
+				}
+
+				break;
+
+			case ARG_LONG:
+				for(size_t j = 0; j < cardinality; j++)
+				{
+					push_i64(ss, ((long*)args[i])[j]);
+				}
+
+				break;
+
+			case ARG_DOUBLE:
+				for(size_t j = 0; j < cardinality; j++)
+				{
+					push_f64(ss, ((double*)args[i])[j]);
+				}
+
+				break;
+
+			case ARG_FLOAT:
+				for(size_t j = 0; j < cardinality; j++)
+				{
+					push_f32(ss, ((float*)args[i])[j]);
+				}
+
+				break;
+		}
+	}
 }
 
-int NameService::resolve_helper(unsigned id, Name &ret) const
+void pop_args(std::stringstream &ss, const Function &func, void **args, bool is_output)
 {
-	RightMap::const_iterator it = this->id_to_name.find(id);
-
-	if(it == this->id_to_name.end())
+	for(size_t i = 0; i < func.types.size(); i++)
 	{
-		return NO_AVAILABLE_SERVER;
-	}
+		int arg_type = func.types[i];
+		size_t cardinality = get_arg_car(arg_type);
 
-	ret = it->second;
-	return OK;
+		if(is_output ? !is_arg_output(arg_type) : !is_arg_input(arg_type))
+		{
+			continue;
+		}
+
+		switch(get_arg_data_type(arg_type))
+		{
+			case ARG_CHAR:
+				for(size_t j = 0; j < cardinality; j++)
+				{
+					((char*)args[i])[j] = pop_i8(ss);
+				}
+
+				break;
+
+			case ARG_SHORT:
+				for(size_t j = 0; j < cardinality; j++)
+				{
+					((short*)args[i])[j] = pop_i16(ss);
+				}
+
+				break;
+
+			case ARG_INT:
+				for(size_t j = 0; j < cardinality; j++)
+				{
+					((int*)args[i])[j] = pop_i32(ss);
+				}
+
+				break;
+
+			case ARG_LONG:
+				for(size_t j = 0; j < cardinality; j++)
+				{
+					((long*)args[i])[j] = pop_i64(ss);
+				}
+
+				break;
+
+			case ARG_DOUBLE:
+				for(size_t j = 0; j < cardinality; j++)
+				{
+					((double*)args[i])[j] = pop_f64(ss);
+				}
+
+				break;
+
+			case ARG_FLOAT:
+				for(size_t j = 0; j < cardinality; j++)
+				{
+					((float*)args[i])[j] = pop_f32(ss);
+				}
+
+				break;
+		}
+	}
 }
 
-int NameService::resolve(const Name &name, unsigned &ret)
+int NameService::resolve(unsigned id, Name &ret)
 {
-	ScopedLock lock(this->mutex);
-	return this->resolve_helper(name, ret);
+	unsigned epoch;
+	const Directory &dir = this->read_begin(epoch);
+	const Name *name = dir.id_to_name.find(id);
+	int retval = NO_AVAILABLE_SERVER;
+
+	if(name != NULL)
+	{
+		ret = *name;
+		retval = OK;
+	}
+
+	this->read_end(epoch);
+	return retval;
 }
 
-int NameService::resolve_helper(const Name &name, unsigned &ret) const
+int NameService::resolve(const Name &name, unsigned &ret)
 {
-	LeftMap::const_iterator it = this->name_to_id.find(name);
+	unsigned epoch;
+	const Directory &dir = this->read_begin(epoch);
+	const unsigned *id = dir.name_to_id.find(name_key(name));
+	int retval = NO_AVAILABLE_SERVER;
 
-	if(it == this->name_to_id.end())
+	if(id != NULL)
 	{
-		return NO_AVAILABLE_SERVER;
+		ret = *id;
+		retval = OK;
 	}
 
-	ret = it->second;
-	return OK;
+	this->read_end(epoch);
+	return retval;
 }
 
 void NameService::register_name(unsigned id, const Name &name)
 {
 	ScopedLock lock(this->mutex);
-	this->register_name_helper(id, name);
+	Directory *dir = this->copy_current();
+	register_name_helper(*dir, id, name);
+	this->publish(dir);
 }
 
-void NameService::register_name_helper(unsigned id, const Name &name)
+void NameService::register_name_helper(Directory &dir, unsigned id, const Name &name)
 {
 #ifndef NDEBUG
-	std::cout << "Registering name id:" << id << ' ' << to_format(name) << " log#:" << (this->logs.size()+1) <<std::endl;
+	std::cout << "Registering name id:" << id << ' ' << to_format(name) << " log#:" << (dir.get_version() + 1) <<std::endl;
 #endif
 	// this is an internal method which is called to insert a NEW name
-	this->id_to_name.insert(std::make_pair(id, name));
-	assert(this->name_to_id.find(name) == this->name_to_id.end());
-	this->name_to_id.insert(std::make_pair(name,id));
+	dir.id_to_name[id] = name;
+	assert(dir.name_to_id.find(name_key(name)) == NULL);
+	dir.name_to_id[name_key(name)] = id;
+	dir.id_floor = std::max(dir.id_floor, id + 1);
 	// add a new log entry
 	std::stringstream ss;
 	push_i32(ss, id);
 	push_i32(ss, name.ip);
 	push_i32(ss, name.port);
 	LogEntry log = { NEW_NODE, ss.str() };
-	this->logs.push_back(log);
+	append_log(dir, log);
 }
 
 void NameService::kill(unsigned id)
 {
 	ScopedLock lock(this->mutex);
-	this->kill_helper(id);
+
+	if(this->current->id_to_name.find(id) == NULL)
+	{
+		// several binder threads can find the same dead server
+		return;
+	}
+
+	Directory *dir = this->copy_current();
+	kill_helper(*dir, id);
+	this->publish(dir);
 }
 
-void NameService::kill_helper(unsigned id)
+void NameService::kill_helper(Directory &dir, unsigned id)
 {
 #ifndef NDEBUG
-	std::cout << "killing node:" << id << " log#:" << (this->logs.size() + 1) << std::endl;
+	std::cout << "killing node:" << id << " log#:" << (dir.get_version() + 1) << std::endl;
 #endif
 	// remove entry from the bi-directional map
-	RightMap::iterator it = this->id_to_name.find(id);
-	assert(it != this->id_to_name.end());
-	this->name_to_id.erase(it->second);
-	this->id_to_name.erase(id);
+	const Name *name = dir.id_to_name.find(id);
+	assert(name != NULL);
+	dir.name_to_id.erase(name_key(*name));
+	dir.id_to_name.erase(id);
+
+	// and from every function it registered, so suggestions are always alive
+	for(size_t i = 0; i < dir.func_to_ids.capacity(); i++)
+	{
+		if(!dir.func_to_ids.is_used(i) || dir.func_to_ids.value_at(i)->positions.find(id) == NULL)
+		{
+			continue;
+		}
+
+		Function func = dir.func_to_ids.key_at(i);
+		NameIdsWithPivot &list = dir.get_writable(func);
+		// move the last id into the hole
+		unsigned pos = *list.positions.find(id);
+		list.ids[pos] = list.ids.back();
+		list.positions[list.ids[pos]] = pos;
+		list.ids.pop_back();
+		list.positions.erase(id);
+
+		if(list.ids.empty())
+		{
+			delete &list;
+			dir.func_to_ids.erase(func);
+		}
+	}
+
 	// add a log entry
 	std::stringstream buf;
 	push_i32(buf, id);
 	LogEntry entry = { KILL_NODE, buf.str() };
-	logs.push_back(entry);
+	append_log(dir, entry);
 }
 
 Function Function::to_signiture() const
@@ -259,6 +522,30 @@ Function Function::to_signiture() const
 	return func;
 }
 
+size_t hash_signiture(const Function &func)
+{
+	// FNV-1a over the name and the signiture of the types (see to_signiture); does not allocate
+	size_t hash = 2166136261u;
+
+	for(size_t i = 0; i < func.name.size(); i++)
+	{
+		hash = (hash ^ static_cast<unsigned char>(func.name[i])) * 16777619u;
+	}
+
+	for(size_t i = 0; i < func.types.size(); i++)
+	{
+		unsigned type = (func.types[i] & 0xffff0000) | (static_cast<unsigned short>(func.types[i]) != 0);
+		hash = (hash ^ type) * 16777619u;
+	}
+
+	return hash;
+}
+
+size_t SignitureHasher::operator()(const Function &func) const
+{
+	return hash_signiture(func);
+}
+
 bool operator< (const Function& lhs, const Function& rhs)
 {
 	Function lhs_sig = lhs.to_signiture();
@@ -267,9 +554,24 @@ bool operator< (const Function& lhs, const Function& rhs)
 	       < std::make_pair(rhs_sig.name, rhs_sig.types);
 }
 
-bool operator< (const Name& lhs, const Name& rhs)
+bool operator== (const Function& lhs, const Function& rhs)
 {
-	return std::make_pair(lhs.ip, lhs.port) < std::make_pair(rhs.ip, rhs.port);
+	if(lhs.name != rhs.name || lhs.types.size() != rhs.types.size())
+	{
+		return false;
+	}
+
+	// array cardinality does not matter, as in to_signiture
+	for(size_t i = 0; i < lhs.types.size(); i++)
+	{
+		if((lhs.types[i] >> 16) != (rhs.types[i] >> 16)
+		   || (static_cast<unsigned short>(lhs.types[i]) == 0) != (static_cast<unsigned short>(rhs.types[i]) == 0))
+		{
+			return false;
+		}
+	}
+
+	return true;
 }
 
 Function to_function(const char *name_cstr, int *argTypes)
@@ -297,15 +599,57 @@ Function to_function(const char *name_cstr, int *argTypes)
 	return func;
 }
 
+NameService::NameIds NameService::get_servers(const Function &func)
+{
+	unsigned epoch;
+	const Directory &dir = this->read_begin(epoch);
+	NameIdsWithPivot *const *list = dir.func_to_ids.find(func);
+	NameIds ret;
+
+	if(list != NULL)
+	{
+		ret = (*list)->ids;
+	}
+
+	this->read_end(epoch);
+	return ret;
+}
+
 unsigned NameService::get_version()
 {
-	ScopedLock lock(this->mutex);
-	return this->get_version_helper();
+	unsigned epoch;
+	unsigned version = this->read_begin(epoch).get_version();
+	this->read_end(epoch);
+	return version;
 }
 
-unsigned NameService::get_version_helper() const
+unsigned NameService::get_id_floor()
 {
-	return this->logs.size();
+	unsigned epoch;
+	unsigned id_floor = this->read_begin(epoch).id_floor;
+	this->read_end(epoch);
+	return id_floor;
+}
+
+unsigned NameService::Directory::get_version() const
+{
+	return this->base_version + this->logs.size();
+}
+
+void NameService::append_log(Directory &dir, const LogEntry &entry)
+{
+	dir.logs.push_back(entry);
+
+	if(dir.logs.size() >= 2 * NS_LOG_TAIL)
+	{
+		// keep the newest NS_LOG_TAIL entries; amortized O(1) per entry
+		size_t num_dropped = dir.logs.size() - NS_LOG_TAIL;
+		dir.logs.erase(dir.logs.begin(), dir.logs.begin() + num_dropped);
+		dir.base_version += num_dropped;
+#ifndef NDEBUG
+		std::cout << "compacted logs, base version:" << dir.base_version << std::endl;
+#endif
+	}
 }
 
 bool is_arg_input(int arg_type)
@@ -325,6 +669,34 @@ size_t get_arg_car(int arg_type)
 	return std::max(static_cast<unsigned short>(1), low);
 }
 
+size_t get_arg_size(int arg_type)
+{
+	size_t cardinality = get_arg_car(arg_type);
+
+	switch(get_arg_data_type(arg_type))
+	{
+		case ARG_CHAR:
+			return cardinality * sizeof(char);
+
+		case ARG_SHORT:
+			return cardinality * sizeof(short);
+
+		case ARG_INT:
+			return cardinality * sizeof(int);
+
+		case ARG_LONG:
+			return cardinality * sizeof(long);
+
+		case ARG_DOUBLE:
+			return cardinality * sizeof(double);
+
+		case ARG_FLOAT:
+			return cardinality * sizeof(float);
+	}
+
+	return 0;
+}
+
 bool is_arg_scalar(int arg_type)
 {
 	return static_cast<unsigned short>(arg_type) == 0;
@@ -339,50 +711,171 @@ int get_arg_data_type(int arg_type)
 std::string NameService::get_logs(unsigned since)
 {
 	std::stringstream ss;
-	ScopedLock lock(this->mutex);
-	unsigned num_delta = (this->get_version_helper() <= since)
+	unsigned epoch;
+	const Directory &dir = this->read_begin(epoch);
+
+	if(since < dir.base_version)
+	{
+		// the entries the remote needs are gone
+#ifndef NDEBUG
+		std::cout << "sending snapshot since:" << since << " my version:" << dir.get_version() << std::endl;
+#endif
+		push_i8(ss, true);
+		push_snapshot_helper(ss, dir);
+		this->read_end(epoch);
+		return ss.str();
+	}
+
+	unsigned num_delta = (dir.get_version() <= since)
 	                     ? 0
-	                     : this->get_version_helper() - since;
+	                     : dir.get_version() - since;
 #ifndef NDEBUG
-	std::cout << "sending log (num_delta:" << num_delta << ") since:" << since << " my version:" << get_version_helper() << std::endl;
+	std::cout << "sending log (num_delta:" << num_delta << ") since:" << since << " my version:" << dir.get_version() << std::endl;
 #endif
+	push_i8(ss, false);
 	push_i32(ss, num_delta);
 
 	for(unsigned i = 0; i < num_delta; i++)
 	{
 		unsigned cur_ver= since + i;
-		// note: vector starts from zero but logs[0] contains version 1
+		// note: vector starts from zero but logs[0] contains version base_version + 1
 		push_i32(ss, cur_ver + 1);
-		push(ss, this->logs[cur_ver]);
+		push(ss, dir.logs[cur_ver - dir.base_version]);
 	}
 
+	this->read_end(epoch);
 	return ss.str();
 }
 
+void NameService::push_snapshot_helper(std::stringstream &ss, const Directory &dir)
+{
+	push_i32(ss, dir.get_version());
+	push_i32(ss, dir.id_floor);
+	push_i32(ss, dir.id_to_name.size());
+
+	for(size_t i = 0; i < dir.id_to_name.capacity(); i++)
+	{
+		if(dir.id_to_name.is_used(i))
+		{
+			push_i32(ss, dir.id_to_name.key_at(i));
+			push_i32(ss, dir.id_to_name.value_at(i).ip);
+			push_i32(ss, dir.id_to_name.value_at(i).port);
+		}
+	}
+
+	push_i32(ss, dir.func_to_ids.size());
+
+	for(size_t i = 0; i < dir.func_to_ids.capacity(); i++)
+	{
+		if(!dir.func_to_ids.is_used(i))
+		{
+			continue;
+		}
+
+		const NameIds &ids = dir.func_to_ids.value_at(i)->ids;
+		push(ss, dir.func_to_ids.key_at(i));
+		push_i32(ss, ids.size());
+
+		for(size_t j = 0; j < ids.size(); j++)
+		{
+			push_i32(ss, ids[j]);
+		}
+	}
+}
+
+NameService::Directory *NameService::apply_snapshot_helper(std::stringstream &ss, const Directory &cur)
+{
+	// read everything first -- the caller reads the rest of the message after the snapshot
+	Directory *dir = new Directory();
+	dir->base_version = pop_i32(ss);
+	dir->id_floor = pop_i32(ss);
+	unsigned num_names = pop_i32(ss);
+
+	for(unsigned i = 0; i < num_names; i++)
+	{
+		unsigned id = pop_i32(ss);
+		Name name;
+		name.ip = pop_i32(ss);
+		name.port = pop_i32(ss);
+		dir->id_to_name[id] = name;
+		dir->name_to_id[name_key(name)] = id;
+	}
+
+	unsigned num_funcs = pop_i32(ss);
+
+	for(unsigned i = 0; i < num_funcs; i++)
+	{
+		Function func = func_from_sstream(ss);
+		NameIdsWithPivot &list = dir->get_writable(func);
+		unsigned num_ids = pop_i32(ss);
+
+		for(unsigned j = 0; j < num_ids; j++)
+		{
+			unsigned id = pop_i32(ss);
+			list.positions[id] = list.ids.size();
+			list.ids.push_back(id);
+		}
+	}
+
+#ifndef NDEBUG
+	std::cout << "got snapshot version:" << dir->base_version << ", my version:" << cur.get_version() << std::endl;
+#endif
+
+	if(dir->base_version <= cur.get_version())
+	{
+		// already up-to-date
+		delete dir;
+		return NULL;
+	}
+
+	return dir;
+}
+
 int NameService::apply_logs(std::stringstream &ss)
 {
 	ScopedLock lock(this->mutex);
+	bool is_snapshot = pop_i8(ss);
+
+	if(is_snapshot)
+	{
+		Directory *dir = apply_snapshot_helper(ss, *this->current);
+
+		if(dir != NULL)
+		{
+			this->publish(dir);
+		}
+
+		return OK;
+	}
+
 	unsigned num_delta = pop_i32(ss);
-	LogEntries entries;
+	// the whole delta is published as one new directory
+	Directory *dir = NULL;
 #ifndef NDEBUG
-	std::cout << "applying " << num_delta << " logs, current version:" << get_version_helper() << std::endl;
+	std::cout << "applying " << num_delta << " logs, current version:" << this->current->get_version() << std::endl;
 #endif
 
 	for(size_t i = 0; i < num_delta; i++)
 	{
 		unsigned log_version = pop_i32(ss);
-#ifndef NDEBUG
-		std::cout << "\tgot log - their version:" << log_version << ", my version:" << get_version_helper() << std::endl;
-#endif
 		LogEntry entry = pop_entry(ss);
 		std::stringstream entry_ss(entry.details);
+		unsigned my_version = (dir == NULL) ? this->current->get_version() : dir->get_version();
+#ifndef NDEBUG
+		std::cout << "\tgot log - their version:" << log_version << ", my version:" << my_version << std::endl;
+#endif
 
-		if(log_version <= get_version_helper())
+		if(log_version <= my_version)
 		{
 			continue;
 		}
 
-		assert(log_version == get_version_helper() + 1);
+		assert(log_version == my_version + 1);
+
+		if(dir == NULL)
+		{
+			dir = this->copy_current();
+		}
 
 		switch(entry.type)
 		{
@@ -392,14 +885,14 @@ int NameService::apply_logs(std::stringstream &ss)
 				Name name;
 				name.ip = pop_i32(entry_ss);
 				name.port = pop_i32(entry_ss);
-				this->register_name_helper(id, name);
+				register_name_helper(*dir, id, name);
 			}
 			break;
 
 			case KILL_NODE:
 			{
 				unsigned id = pop_i32(entry_ss);
-				this->kill_helper(id);
+				kill_helper(*dir, id);
 			}
 			break;
 
@@ -407,14 +900,19 @@ int NameService::apply_logs(std::stringstream &ss)
 			{
 				unsigned id = pop_i32(entry_ss);
 				Function func = func_from_sstream(entry_ss);
-				this->register_fn_helper(id, func);
+				register_fn_helper(*dir, id, func);
 			}
 			break;
 		}
 	}
 
+	if(dir != NULL)
+	{
+		this->publish(dir);
+	}
+
 #ifndef NDEBUG
-	std::cout << "finished apply logs, current version:" << get_version_helper() << std::endl;
+	std::cout << "finished apply logs, current version:" << this->current->get_version() << std::endl;
 #endif
 	return OK;
 }
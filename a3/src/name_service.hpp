@@ -1,8 +1,8 @@
 #ifndef _name_service_hpp_
 #define _name_service_hpp_
 
-#include <map>
-#include <set>
+#include "config.hpp"
+#include "flat_hash.hpp"
 #include <string>
 #include <vector>
 #include <pthread.h>
@@ -22,9 +22,25 @@ public: // methods
 	Function to_signiture() const;
 };
 
+// hashes the signiture, so it agrees with operator== (and operator<)
+struct SignitureHasher
+{
+	size_t operator()(const Function &func) const;
+};
+
 class NameService
 {
 public: // typedefs
+	// the binder's components that must see every change of the name directory (Journal, Watchers)
+	class Listener
+	{
+	public:
+		virtual ~Listener() {}
+		// called right after a new directory is published, with the writer lock still held,
+		// so calls come in version order; must not write to the NameService
+		virtual void published(NameService &ns) = 0;
+	};
+
 	enum LogType
 	{
 		NEW_NODE,
@@ -39,32 +55,72 @@ public: // typedefs
 	};
 	typedef std::vector<LogEntry> LogEntries;
 
-	typedef std::set<unsigned> NameIds;
+	typedef std::vector<unsigned> NameIds;
 	typedef std::vector<Name> Names;
-	// the pivot (unsigned) is used for round-robin suggestions
-	typedef std::pair<NameIds, size_t> NameIdsWithPivot;
+	// the servers of a function; ids is dense so a suggestion is ids[pivot % size]
+	// a list is shared by the directories that did not change it (copy-on-write)
+	struct NameIdsWithPivot
+	{
+		NameIds ids;
+		FlatHash<unsigned, unsigned, IntHasher> positions; // id to its index in ids
+		mutable unsigned pivot; // readers bump it without a lock
+		unsigned refs; // number of directories using this list; changed only by writers
+	};
 
 	// the following should simulate bidirectional search
-	typedef std::map<Name,unsigned> LeftMap; // Name to id
-	typedef std::map<unsigned,Name> RightMap; // id to Name
-	typedef std::map<Function, NameIdsWithPivot> FuncPivots;
+	typedef FlatHash<uint64_t, unsigned, IntHasher> LeftMap; // Name (see name_key) to id
+	typedef FlatHash<unsigned, Name, IntHasher> RightMap; // id to Name
+	typedef FlatHash<Function, NameIdsWithPivot *, SignitureHasher> FuncPivots;
+
+	// an immutable version of the name directory; writers copy the current one, change the copy
+	// and publish it, so readers never lock
+	struct Directory
+	{
+		LeftMap name_to_id;
+		RightMap id_to_name;
+		FuncPivots func_to_ids; // only live ids
+		LogEntries logs; // logs[0] is version base_version + 1
+		unsigned base_version; // number of entries that have been compacted away
+		unsigned id_floor; // every id ever registered is below this, even if it was killed
+
+		Directory();
+		Directory(const Directory &other);
+		~Directory();
+		unsigned get_version() const;
+		// returns a list of func that only this directory uses, creating it if needed
+		NameIdsWithPivot &get_writable(const Function &func);
+	private:
+		Directory &operator=(const Directory &other);
+	};
 private: // data
-	LeftMap name_to_id;
-	RightMap id_to_name;
-	std::map<Function, NameIdsWithPivot> func_to_ids;
-	LogEntries logs;
-	pthread_mutex_t mutex;
+	Directory *volatile current;
+	// readers register in readers[epoch & 1]; a writer flips the epoch and waits for the old side
+	// to drain before freeing the directory it replaced
+	volatile unsigned epoch;
+	volatile unsigned readers[2];
+	pthread_mutex_t mutex; // serializes writers
+	std::vector<Listener *> listeners;
 
 private: // methods
-
-	// these are unsynchronized version of the public methods
-	int resolve_helper(const Name &name, unsigned &ret) const;
-	int resolve_helper(unsigned id, Name &ret) const;
-	int suggest_helper(Postman &postman, const Function &func, unsigned &ret, bool is_binder);
-	unsigned get_version_helper() const;
-	void kill_helper(unsigned id);
-	void register_fn_helper(unsigned id, const Function &func);
-	void register_name_helper(unsigned id, const Name &name);
+	// readers must call read_end() with the same epoch, and must not block in between
+	const Directory &read_begin(unsigned &epoch);
+	void read_end(unsigned epoch);
+	// writers call these with mutex held
+	Directory *copy_current() const;
+	void publish(Directory *dir);
+
+	// these modify a directory that has not been published yet
+	static void kill_helper(Directory &dir, unsigned id);
+	static void register_fn_helper(Directory &dir, unsigned id, const Function &func);
+	static void register_name_helper(Directory &dir, unsigned id, const Name &name);
+
+	// every log entry goes through here, so the log can be compacted
+	static void append_log(Directory &dir, const LogEntry &entry);
+
+	// a snapshot is the live part of the name directory at its version
+	static void push_snapshot_helper(std::stringstream &ss, const Directory &dir);
+	// returns NULL if the snapshot is not newer than dir
+	static Directory *apply_snapshot_helper(std::stringstream &ss, const Directory &dir);
 
 public: // methods
 	NameService();
@@ -73,18 +129,31 @@ public: // methods
 	Names get_all_names();
 	int resolve(const Name &name, unsigned &ret);
 	int resolve(unsigned id, Name &ret);
-	int suggest(Postman &postman, const Function &func, unsigned &ret, bool is_binder);
+	// round-robin over the servers that registered func; does no I/O -- dead servers are
+	// removed by the binder's liveness checks (see Liveness) and reach everyone through the logs
+	// resolve, suggest, get_version and get_logs take no lock
+	int suggest(const Function &func, unsigned &ret);
+	// the servers that registered func, in the order suggest() goes through them (empty if none)
+	NameIds get_servers(const Function &func);
 	unsigned get_version();
+	// ids at or above this have never been used; a binder that takes over starts there
+	unsigned get_id_floor();
 
 	// non-binder should update NameService using apply_logs
+	// get_logs() gives a snapshot instead of the delta if since is older than the compacted logs
 	int apply_logs(std::stringstream &ss);
 	std::string get_logs(unsigned since);
 
 	// these 3 methods affect the logs
 	// they should be called directly ONLY by the binder
+	// kill() does nothing if the id has already been killed (e.g. by another binder thread)
+	// each call publishes a new directory, so it is O(size of the directory)
 	void kill(unsigned id);
 	void register_fn(unsigned id, const Function &func);
 	void register_name(unsigned id, const Name &name);
+
+	// not synchronized; add listeners before other threads use the NameService
+	void add_listener(Listener *listener);
 };
 
 // utility methods
@@ -94,15 +163,25 @@ Function func_from_sstream(std::stringstream &ss);
 Function to_function(const char *name_cstr, int *argTypes);
 void push(std::stringstream &ss, const Function &func);
 
+// arguments; is_output picks the outputs (replies) or the inputs (requests) of func
+void push_args(std::stringstream &ss, const Function &func, void **args, bool is_output);
+// args must already point to buffers of get_arg_size() bytes
+void pop_args(std::stringstream &ss, const Function &func, void **args, bool is_output);
+
+size_t hash_signiture(const Function &func);
+
 // arg types
 bool is_arg_input(int arg_type);
 bool is_arg_output(int arg_type);
 bool is_arg_scalar(int arg_type);
 int get_arg_data_type(int arg_type);
 size_t get_arg_car(int arg_type);
+// bytes of the argument's buffer (cardinality times the size of the data type)
+size_t get_arg_size(int arg_type);
 
 // needed for std::map
 bool operator< (const Function& lhs, const Function& rhs);
-bool operator< (const Name& lhs, const Name& rhs);
+// needed for FlatHash; compares signitures
+bool operator== (const Function& lhs, const Function& rhs);
 
 #endif
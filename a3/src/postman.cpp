@@ -2,12 +2,20 @@
 #include "name_service.hpp"
 #include "postman.hpp"
 #include "rpc.h"
+#include "trace.hpp"
+#include <algorithm>
 #include <cassert>
 #include <sstream>
 
 static void push(std::stringstream &ss, Postman::Message &msg);
 
+// ns_version, msg_type, size
+static const size_t HEADER_SIZE = 12;
+// set in msg_type on the wire when an 8-byte trace id follows the header
+static const int TRACE_FLAG = (1 << 30);
+
 Postman::Postman(NameService &ns) :
+	incoming_max_depth(0),
 	ns(ns)
 {
 	int retval = pthread_mutex_init(&this->asm_buf_mutex, NULL);
@@ -30,14 +38,23 @@ Postman::~Postman()
 	pthread_mutex_destroy(&this->outgoing_mutex);
 }
 
-int Postman::send(int remote_fd, Message &msg)
+int Postman::send(int remote_fd, Message &msg, unsigned conn_id, bool is_blocking)
 {
+	// hold the socket lock throughout, so remote_fd can't be closed and reused between the check and the flush
+	ScopedLock lock(this->soc_mutex);
+
+	if(conn_id != 0 && !this->sockets.is_alive(remote_fd, conn_id))
+	{
+		// the requester has gone away; don't hand its reply to whoever owns the fd now
+		return REMOTE_DISCONNECTED;
+	}
+
+	this->metrics.sent(msg.msg_type, HEADER_SIZE + (msg.trace_id != 0 ? 8 : 0) + msg.size);
 	{
 		ScopedLock lock(this->outgoing_mutex);
 		this->outgoing[remote_fd].push(msg);
 	}
-	ScopedLock lock(this->soc_mutex);
-	return this->sockets.flush(remote_fd);
+	return this->sockets.flush(remote_fd, is_blocking);
 }
 
 int Postman::send_register(int binder_fd, int my_id, const Function &func)
@@ -54,100 +71,12 @@ int Postman::send_execute(int server_fd, const Function &func, void **args, bool
 	std::stringstream ss;
 	push_i8(ss, is_force_queue_task);
 	push(ss, func);
-
-	for(size_t i = 0; i < func.types.size(); i++)
-	{
-		int arg_type = func.types[i];
-
-		if(!is_arg_input(arg_type))
-		{
-			continue;
-		}
-
-		// there is no point in differentiating b/w scalar and array of size 1
-		size_t cardinality = get_arg_car(arg_type);
-
-		switch(get_arg_data_type(arg_type))
-		{
-			case ARG_CHAR:
-			{
-				char *argsi = (char*)args[i];
-
-				for(size_t j = 0; j < cardinality; j++)
-				{
-					push_i8(ss, argsi[j]);
-				}
-
-				break;
-			}
-
-			case ARG_SHORT:
-			{
-				short *argsi = (short*)args[i];
-
-				for(size_t j = 0; j < cardinality; j++)
-				{
-					push_i16(ss, argsi[j]);
-				}
-
-				break;
-			}
-
-			case ARG_INT:
-			{
-				int *argsi = (int*)args[i];
-
-				for(size_t j = 0; j < cardinality; j++)
-				{
-					push_i32(ss, argsi[j]);
-				}
-
-				break;
-			}
-
-			case ARG_LONG:
-			{
-				long *argsi = (long*)args[i];
-
-				for(size_t j = 0; j < cardinality; j++)
-				{
-					push_i64(ss, argsi[j]);
-				}
-
-				break;
-			}
-
-			case ARG_DOUBLE:
-			{
-				double *argsi = (double*)args[i];
-
-				for(size_t j = 0; j < cardinality; j++)
-				{
-					push_f64(ss, argsi[j]);
-				}
-
-				break;
-			}
-
-			case ARG_FLOAT:
-			{
-				float *argsi = (float*)args[i];
-
-				for(size_t j = 0; j < cardinality; j++)
-				{
-					push_f32(ss, argsi[j]);
-				}
-
-				break;
-			}
-		}
-	}
-
+	push_args(ss, func, args, false);
 	Message msg = to_message(EXECUTE, ss.str());
 	return this->send(server_fd, msg);
 }
 
-int Postman::reply_execute(int remote_fd, int retval, const Function &func, void **args, unsigned remote_ns_version)
+int Postman::reply_execute(int remote_fd, unsigned conn_id, int retval, const Function &func, void **args, unsigned remote_ns_version)
 {
 	std::stringstream ss;
 	ss << this->ns.get_logs(remote_ns_version);
@@ -155,73 +84,11 @@ int Postman::reply_execute(int remote_fd, int retval, const Function &func, void
 
 	if(retval >= 0)
 	{
-		// extract output
-		for(size_t i = 0; i < func.types.size(); i++)
-		{
-			int arg_type = func.types[i];
-			void * const argsi = args[i];
-			size_t cardinality = get_arg_car(arg_type);
-
-			if(!is_arg_output(arg_type))
-			{
-				continue;
-			}
-
-			switch(get_arg_data_type(arg_type))
-			{
-				case ARG_CHAR:
-					for(size_t j = 0; j < cardinality; j++)
-					{
-						push_i8(ss, ((char*)argsi)[j]);
-					}
-
-					break;
-
-				case ARG_SHORT:
-					for(size_t j = 0; j < cardinality; j++)
-					{
-						push_i16(ss, ((short*)args[i])[j]);
-					}
-
-					break;
-
-				case ARG_INT:
-					for(size_t j = 0; j < cardinality; j++)
-					{
-						push_i32(ss, ((int*)args[i])[j]);
-					}
-
-					break;
-
-				case ARG_LONG:
-					for(size_t j = 0; j < cardinality; j++)
-					{
-						push_i64(ss, ((long*)argsi)[j]);
-					}
-
-					break;
-
-				case ARG_DOUBLE:
-					for(size_t j = 0; j < cardinality; j++)
-					{
-						push_f64(ss, ((double*)args[i])[j]);
-					}
-
-					break;
-
-				case ARG_FLOAT:
-					for(size_t j = 0; j < cardinality; j++)
-					{
-						push_f32(ss, ((float*)args[i])[j]);
-					}
-
-					break;
-			}
-		}
+		push_args(ss, func, args, true);
 	}
 
 	Message msg = to_message(EXECUTE_REPLY, ss.str());
-	return this->send(remote_fd, msg);
+	return this->send(remote_fd, msg, conn_id);
 }
 
 int Postman::send_ns_update(int remote_fd)
@@ -236,6 +103,13 @@ int Postman::send_terminate(int remote_fd)
 	return this->send(remote_fd, msg);
 }
 
+int Postman::send_watch(int binder_fd)
+{
+	// the message header carries our version, so the first push brings us up-to-date
+	Message msg = to_message(WATCH, "");
+	return this->send(binder_fd, msg);
+}
+
 int Postman::send_confirm_terminate(int remote_fd, bool is_terminate)
 {
 	std::stringstream ss;
@@ -246,7 +120,8 @@ int Postman::send_confirm_terminate(int remote_fd, bool is_terminate)
 
 Postman::Message Postman::to_message(Postman::MessageType type, std::string msg)
 {
-	Postman::Message ret = {this->ns.get_version(), msg.size(), type, msg};
+	// replies and nested requests carry the trace of the thread that sends them
+	Postman::Message ret = {this->ns.get_version(), msg.size(), type, msg, get_trace_id()};
 	return ret;
 }
 
@@ -269,7 +144,8 @@ int Postman::sync_and_receive_any(Request &ret, int *need_alive_fd)
 			return REMOTE_DISCONNECTED;
 		}
 
-		if(this->sockets.sync() < 0)
+		// other threads can send and connect while sync() is blocked in select()
+		if(this->sockets.sync(&this->soc_mutex) < 0)
 		{
 			// some error occurred
 			//TODO ???
@@ -280,6 +156,20 @@ int Postman::sync_and_receive_any(Request &ret, int *need_alive_fd)
 	return OK;
 }
 
+int Postman::poll_and_receive_any(Request &ret, long timeout_ms)
+{
+	if(this->receive_any(ret) >= 0)
+	{
+		return OK;
+	}
+
+	{
+		ScopedLock lock(this->soc_mutex);
+		this->sockets.sync(&this->soc_mutex, timeout_ms);
+	}
+	return this->receive_any(ret);
+}
+
 int Postman::send_loc_request(int binder_fd, const Function &func)
 {
 	std::stringstream ss;
@@ -304,6 +194,12 @@ int Postman::reply_ns_update(int remote_fd, unsigned remote_ns_version)
 	return send(remote_fd, msg);
 }
 
+int Postman::push_ns_update(int remote_fd, unsigned conn_id, unsigned remote_ns_version)
+{
+	Message msg = to_message(NS_UPDATE_SENT, this->ns.get_logs(remote_ns_version));
+	return send(remote_fd, msg, conn_id, false);
+}
+
 int Postman::reply_server_ok(int remote_fd, unsigned id, unsigned remote_ns_version)
 {
 	std::stringstream ss;
@@ -318,9 +214,7 @@ int Postman::reply_loc_request(int remote_fd, const Function &func, unsigned rem
 	unsigned target_id;
 	std::stringstream ss;
 	Message msg;
-	bool is_binder = true; // this method can only be called by the binder
-
-	if(this->ns.suggest(*this, func, target_id, is_binder) < 0)
+	if(this->ns.suggest(func, target_id) < 0)
 	{
 		push_i8(ss, false); // failure
 		ss << this->ns.get_logs(remote_ns_version);
@@ -341,9 +235,7 @@ int Postman::reply_loc_request(int remote_fd, const Function &func, unsigned rem
 
 void Postman::read_avail(int fd, const std::string &got)
 {
-	std::stringstream ss(got);
 	ScopedLock lock(this->asm_buf_mutex);
-	Message &req_buf = this->asm_buf[fd];
 
 	if(got.empty())
 	{
@@ -351,35 +243,53 @@ void Postman::read_avail(int fd, const std::string &got)
 		return;
 	}
 
-	if(req_buf.str.empty())
+	// one read may end a message, hold several more (e.g. pushes to a watcher), and start another
+	std::string &raw = this->asm_buf[fd];
+	raw.append(got);
+	size_t offset = 0;
+
+	while(raw.size() - offset >= HEADER_SIZE)
 	{
-		// this is a new request, so the header (8 bytes) must be read
-		req_buf.ns_version = pop_i32(ss);
-		req_buf.msg_type = static_cast<MessageType>(pop_i32(ss));
-		req_buf.size = pop_i32(ss);
-		// data + null character
-		req_buf.str.reserve(req_buf.size + 1);
-	}
+		std::stringstream ss(raw.substr(offset, HEADER_SIZE));
+		Message msg;
+		msg.ns_version = pop_i32(ss);
+		int msg_type = pop_i32(ss);
+		msg.msg_type = static_cast<MessageType>(msg_type & ~TRACE_FLAG);
+		msg.size = pop_i32(ss);
+		size_t header_size = HEADER_SIZE + ((msg_type & TRACE_FLAG) ? 8 : 0);
+
+		if(raw.size() - offset < header_size || raw.size() - offset - header_size < msg.size)
+		{
+			// the rest comes with later reads
+			break;
+		}
 
-	// copy message into the assembling buffer
-	size_t remaining = req_buf.size - req_buf.str.size();
-	char *buf = new char[remaining];
-	ss.read(buf, remaining);
-	size_t num_read = static_cast<size_t>(ss.gcount());
-	req_buf.str.append(buf, num_read);
-	delete [] buf;
+		msg.trace_id = 0;
 
-	if(num_read == remaining)
-	{
-		// this request is ready
-		Request req = { fd, req_buf }; // copy message
+		if(header_size > HEADER_SIZE)
 		{
-			ScopedLock(this->incoming_mutex);
-			incoming.push(req);
+			std::stringstream trace_ss(raw.substr(offset + HEADER_SIZE, 8));
+			msg.trace_id = pop_i64(trace_ss);
 		}
-		// remove the temporary object in the assembler
+
+		msg.str = raw.substr(offset + header_size, msg.size);
+		offset += header_size + msg.size;
+		this->metrics.received(msg.msg_type, header_size + msg.size);
+		// read_avail is called by sync(), which already holds soc_mutex
+		Request req = { fd, this->sockets.get_conn_id(fd), msg, now_us() };
+		ScopedLock lock(this->incoming_mutex);
+		incoming.push(req);
+		this->incoming_max_depth = std::max(this->incoming_max_depth, this->incoming.size());
+	}
+
+	if(offset == raw.size())
+	{
 		this->asm_buf.erase(fd);
 	}
+	else
+	{
+		raw.erase(0, offset);
+	}
 }
 
 int Postman::receive_any(Request &ret)
@@ -394,6 +304,7 @@ int Postman::receive_any(Request &ret)
 	// copy and remove
 	ret = this->incoming.front();
 	this->incoming.pop();
+	this->metrics.waited(ret.message.msg_type, now_us() - ret.received_us);
 	return OK;
 }
 
@@ -413,24 +324,69 @@ const std::string Postman::write_avail(int fd)
 	return ss.str();
 }
 
+bool Postman::is_write_avail(int fd)
+{
+	ScopedLock lock(this->outgoing_mutex);
+	OutgoingRequests::const_iterator it = this->outgoing.find(fd);
+	return it != this->outgoing.end() && !it->second.empty();
+}
+
+void Postman::disconnected(int fd)
+{
+	// called by Sockets (under soc_mutex) once fd is closed
+	{
+		ScopedLock lock(this->asm_buf_mutex);
+		this->asm_buf.erase(fd);
+	}
+	ScopedLock lock(this->outgoing_mutex);
+	this->outgoing.erase(fd);
+}
+
 static void push(std::stringstream &ss, Postman::Message &msg)
 {
 	push_i32(ss, msg.ns_version);
-	push_i32(ss, msg.msg_type);
+	push_i32(ss, msg.msg_type | (msg.trace_id != 0 ? TRACE_FLAG : 0));
 	push_i32(ss, msg.size);
+
+	if(msg.trace_id != 0)
+	{
+		push_i64(ss, msg.trace_id);
+	}
+
 	ss.write(msg.str.c_str(), msg.str.size());
 }
 
 int Postman::connect_remote(const char *hostname, int port)
 {
-	ScopedLock lock(this->soc_mutex);
-	return this->sockets.connect_remote(hostname, port);
+	int ip;
+	{
+		// gethostbyname() isn't reentrant
+		ScopedLock lock(this->soc_mutex);
+		int retval = TCP::Sockets::resolve_hostname(hostname, ip);
+
+		if(retval < 0)
+		{
+			return retval;
+		}
+	}
+	return this->connect_remote(ip, port);
 }
 
-int Postman::connect_remote(int ip, int port)
+int Postman::connect_remote(int ip, int port, long timeout_ms)
 {
+	// connect() can block for a long time, so don't hold up sync() and other senders
+	int fd = TCP::Sockets::open_remote(ip, port, timeout_ms);
+
+	if(fd < 0)
+	{
+		return fd;
+	}
+
 	ScopedLock lock(this->soc_mutex);
-	return this->sockets.connect_remote(ip, port);
+	this->sockets.add_remote(fd);
+	// let sync() watch the new connection
+	this->sockets.wake();
+	return fd;
 }
 
 int Postman::bind_and_listen(int port, int num_listen)
@@ -449,6 +405,8 @@ ScopedConnection::ScopedConnection(Postman &postman, int ip, int port) : fd(post
 
 ScopedConnection::ScopedConnection(Postman &postman, const char *hostname, int port) : fd(postman.connect_remote(hostname, port)), postman(postman) {}
 
+ScopedConnection::ScopedConnection(Postman &postman, int fd) : fd(fd), postman(postman) {}
+
 ScopedConnection::~ScopedConnection()
 {
 	if(fd >= 0)
@@ -468,6 +426,70 @@ size_t Postman::is_alive(int fd)
 	return this->sockets.is_alive(fd);
 }
 
+bool Postman::is_alive(int fd, unsigned conn_id)
+{
+	ScopedLock lock(this->soc_mutex);
+	return this->sockets.is_alive(fd, conn_id);
+}
+
+size_t Postman::get_unsent(int fd)
+{
+	ScopedLock lock(this->soc_mutex);
+	return this->sockets.get_unsent(fd);
+}
+
+void Postman::wake()
+{
+	// the self-pipe needs no lock
+	this->sockets.wake();
+}
+
+unsigned Postman::get_conn_id(int fd)
+{
+	ScopedLock lock(this->soc_mutex);
+	return this->sockets.get_conn_id(fd);
+}
+
+int Postman::send_heartbeat(int binder_fd, unsigned conn_id, int my_id)
+{
+	std::stringstream ss;
+	push_i32(ss, my_id);
+	Message msg = to_message(HEARTBEAT, ss.str());
+	return this->send(binder_fd, msg, conn_id);
+}
+
+int Postman::send_stats(int remote_fd)
+{
+	Message msg = to_message(STATS, "");
+	return this->send(remote_fd, msg);
+}
+
+int Postman::reply_stats(int remote_fd)
+{
+	Metrics::Snapshot snapshot;
+	this->get_stats(snapshot);
+	std::stringstream ss;
+	push(ss, snapshot);
+	Message msg = to_message(STATS_REPLY, ss.str());
+	return this->send(remote_fd, msg);
+}
+
+void Postman::get_stats(Metrics::Snapshot &ret)
+{
+	this->metrics.get(ret);
+	{
+		ScopedLock lock(this->incoming_mutex);
+		ret.incoming_depth = this->incoming.size();
+		ret.incoming_max_depth = this->incoming_max_depth;
+	}
+	ScopedLock lock(this->outgoing_mutex);
+
+	for(OutgoingRequests::iterator it = this->outgoing.begin(); it != this->outgoing.end(); it++)
+	{
+		ret.outgoing_depth += it->second.size();
+	}
+}
+
 int Postman::send_new_server_execute(int remote_fd)
 {
 	Message msg = to_message(NEW_SERVER_EXECUTE, "");
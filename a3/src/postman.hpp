@@ -2,6 +2,7 @@
 #define _postman_hpp_
 
 #include "common.hpp"
+#include "metrics.hpp"
 #include "sockets.hpp"
 #include <map>
 #include <queue>
@@ -33,7 +34,11 @@ public: // typedefs
 		EXECUTE_REPLY       = (1 << 10),
 		CONFIRM_TERMINATE   = (1 << 11), // server ask this question to the binder
 		NEW_SERVER_EXECUTE  = (1 << 12),
-		TERMINATE           = (1 << 13)
+		TERMINATE           = (1 << 13),
+		HEARTBEAT           = (1 << 14), // server to binder over the control connection; no reply
+		WATCH               = (1 << 15), // client subscribes to directory changes; replies are NS_UPDATE_SENT pushes
+		STATS               = (1 << 16), // asks a binder or server for its Metrics
+		STATS_REPLY         = (1 << 17)
 	};
 	struct Message
 	{
@@ -41,20 +46,25 @@ public: // typedefs
 		unsigned int size;
 		MessageType msg_type;
 		std::string str;
+		uint64_t trace_id; // 0 if the message isn't part of a trace; see Tracer
 	};
 	struct Request
 	{
 		int fd;
+		unsigned conn_id; // tells a reused fd apart from the connection that sent the request
 		Message message;
+		long received_us; // when read_avail() queued it
 	};
 	typedef std::queue<Request> IncomingRequests;
 	typedef std::map<int, std::queue<Message> > OutgoingRequests;
-	typedef std::map<int, Message> AssembleBuffer;
+	typedef std::map<int, std::string> AssembleBuffer; // bytes of each fd that don't make a whole message yet
 private: // data
 	TCP::Sockets sockets;
 	IncomingRequests incoming;
 	OutgoingRequests outgoing;
 	AssembleBuffer asm_buf;
+	Metrics metrics;
+	size_t incoming_max_depth; // guarded by incoming_mutex
 	pthread_mutex_t incoming_mutex, outgoing_mutex, asm_buf_mutex, soc_mutex;
 
 public: // refernces
@@ -62,7 +72,10 @@ public: // refernces
 
 private: // helper methods
 	Message to_message(MessageType type, std::string msg);
-	int send(int remote_fd, Message &msg);
+
+	// conn_id = 0 skips the liveness check; otherwise the message is dropped if remote_fd no longer refers to conn_id
+	// see TCP::Sockets::flush for is_blocking
+	int send(int remote_fd, Message &msg, unsigned conn_id = 0, bool is_blocking = true);
 
 	// this is for polling only -- need to call sync() separately
 	int receive_any(Request &ret);
@@ -74,34 +87,53 @@ public: // methods
 	// forward to Sockets
 	int bind_and_listen(int port = 0, int num_listen = 100);
 	size_t is_alive(int fd);
+	bool is_alive(int fd, unsigned conn_id);
+	size_t get_unsent(int fd);
+	void wake();
+	unsigned get_conn_id(int fd);
 	int connect_remote(const char *hostname, int port);
-	int connect_remote(int ip, int port);
+	// see TCP::Sockets::open_remote for timeout_ms
+	int connect_remote(int ip, int port, long timeout_ms = -1);
 	void disconnect(int fd);
 
 	// send requests
 	int send_confirm_terminate(int remote_fd, bool is_terminate = true);
 	int send_execute(int server_fd, const Function &func, void **args, bool is_force_queue_task);
+	int send_heartbeat(int binder_fd, unsigned conn_id, int my_id);
 	int send_iam_server(int binder_fd, int listen_port);
 	int send_loc_request(int binder_fd, const Function &func);
 	int send_new_server_execute(int remote_fd);
 	int send_ns_update(int remote_fd);
 	int send_register(int binder_fd, int my_id, const Function &func);
+	int send_stats(int remote_fd);
 	int send_terminate(int remote_fd);
+	int send_watch(int binder_fd);
 
 	// send replies
-	int reply_execute(int remote_fd, int retval, const Function &func, void **args, unsigned remote_ns_version);
+	int reply_execute(int remote_fd, unsigned conn_id, int retval, const Function &func, void **args, unsigned remote_ns_version);
 	int reply_loc_request(int remote_fd, const Function &func, unsigned remote_ns_version);
 	int reply_ns_update(int remote_fd, unsigned remote_ns_version);
 	int reply_register(int remote_fd, unsigned remote_ns_version);
 	int reply_server_ok(int remote_fd, unsigned id, unsigned remote_ns_version);
+	int reply_stats(int remote_fd);
 	int reply_update_ns(int remote_fd, unsigned remote_ns_version);
+	// NS_UPDATE_SENT to a watcher; dropped if the watch connection has closed
+	// never blocks: what the socket doesn't take is written by a later sync()
+	int push_ns_update(int remote_fd, unsigned conn_id, unsigned remote_ns_version);
+
+	// the Metrics of all threads, and the current queue depths
+	void get_stats(Metrics::Snapshot &ret);
 
 	// this is a blockying (busy-wait) method
 	int sync_and_receive_any(Request &ret, int *need_alive_fd = NULL);
+	// waits up to timeout_ms for the sockets; NOTHING_TO_RECEIVE if no complete message has arrived
+	int poll_and_receive_any(Request &ret, long timeout_ms = 0);
 
 	// defined by TCP::Sockets::DataBuffer
 	virtual void read_avail(int fd, const std::string &got);
 	virtual const std::string write_avail(int fd);
+	virtual bool is_write_avail(int fd);
+	virtual void disconnected(int fd);
 };
 
 // since there are many instances where calls can fail,
@@ -115,6 +147,8 @@ public: // data
 public: // helper methods
 	ScopedConnection(Postman &postman, int ip, int port);
 	ScopedConnection(Postman &postman, const char *hostname, int port);
+	// takes over a connected fd (or a negative error from connecting)
+	ScopedConnection(Postman &postman, int fd);
 	~ScopedConnection();
 	int get_fd() const;
 };
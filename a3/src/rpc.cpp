@@ -1,20 +1,41 @@
 #include "common.hpp"
 #include "debug.hpp"
+#include "flat_hash.hpp"
 #include "name_service.hpp"
 #include "postman.hpp"
 #include "rpc.h"
 #include "sockets.hpp"
 #include "tasks.hpp"
+#include "trace.hpp"
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
 #include <deque>
 #include <map>
+#include <semaphore.h>
 #include <set>
+#include <string>
+#include <vector>
 #include <iostream>
 
 // ============== global variables ==============
 
+// splits a comma-separated list; NULL gives an empty list
+static std::vector<std::string> split_list(const char *str)
+{
+	std::vector<std::string> ret;
+	std::stringstream ss(str == NULL ? "" : str);
+	std::string item;
+
+	while(std::getline(ss, item, ','))
+	{
+		ret.push_back(item);
+	}
+
+	return ret;
+}
+
 class Global
 {
 public: // typedefs
@@ -22,6 +43,17 @@ public: // typedefs
 	// function signitures (diregard array cardinarlity) to skeleton
 	typedef std::map<Function, skeleton> FuncToSkelMap;
 
+	// clients only; the binder's last answer to a LOC_REQUEST, reused by rpcCall until it expires
+	struct Location
+	{
+		int retval; // OK, or the binder's error (e.g. NO_AVAILABLE_SERVER)
+		NameService::NameIds server_ids; // the servers of the function in the name directory
+		unsigned next; // index in server_ids of the next server to call
+		long expires_ms; // now_ms()
+		unsigned ns_version; // of the name directory that the answer (or server_ids) came from
+	};
+	typedef FlatHash<Function, Location, SignitureHasher> Locations;
+
 private: // private
 	std::set<Function> real_signitures;
 	FuncToSkelMap function_map; // for server only
@@ -34,15 +66,34 @@ public: //public
 
 	// server (only set when the process is a server)
 	int server_fd;
+	std::deque<Postman::Request> deferred; // requests that arrived during a wait for something else
 	int server_id;
 	bool has_run_execute;
 	bool is_terminate;
 	Name server_name;
 	bool has_run_calls;
 
-	// binder (used by both clients and servers)
-	const char *binder_hostname;
-	int binder_port;
+	// clients only; the persistent connection that the binder pushes directory changes to (see rpcWatch)
+	int watch_fd;
+	unsigned watch_conn_id;
+
+	// clients only; see find_location
+	Locations locations;
+	long location_ttl_ms, no_server_ttl_ms;
+
+	// binders (used by both clients and servers); BINDER_ADDRESS and BINDER_PORT may list
+	// a primary and its standbys, in the same order (see connect_binder)
+	std::vector<std::string> binder_hostnames;
+	std::vector<int> binder_ports;
+	volatile unsigned binder_index; // the binder that was reachable last time
+
+	// servers only; the cpus the process may run on, read before rpcInit pins the calling thread
+	cpu_set_t process_cpus;
+
+	// server heartbeats; sent by their own thread, so they go out even when the server is busy
+	pthread_t heartbeat_thread;
+	sem_t heartbeat_stop_sem;
+	bool has_heartbeat;
 
 public: //methods
 	Global()
@@ -52,18 +103,67 @@ public: //methods
 		  has_run_execute(false),
 		  is_terminate(false),
 		  has_run_calls(false),
-		  binder_hostname(getenv("BINDER_ADDRESS")),
-		  binder_port(strtol(getenv("BINDER_PORT"), NULL, 10))
+		  watch_fd(-1),
+		  watch_conn_id(0),
+		  location_ttl_ms(get_env_long("RPC_LOCATION_TTL", LOCATION_TTL)),
+		  no_server_ttl_ms(get_env_long("RPC_NO_SERVER_TTL", NO_SERVER_TTL)),
+		  binder_hostnames(split_list(getenv("BINDER_ADDRESS"))),
+		  binder_index(0),
+		  has_heartbeat(false)
 	{
 		// this constructor should not throw exception
-		assert(binder_hostname != NULL);
+		assert(!binder_hostnames.empty());
+		std::vector<std::string> ports = split_list(getenv("BINDER_PORT"));
+
+		for(size_t i = 0; i < ports.size(); i++)
+		{
+			binder_ports.push_back(strtol(ports[i].c_str(), NULL, 10));
+		}
+
+		if(binder_ports.size() != binder_hostnames.size())
+		{
+			// no way to tell which port goes with which host; every call gets BINDER_UNAVAILABLE
+			binder_hostnames.clear();
+			binder_ports.clear();
+		}
+
+		int retval = sem_init(&heartbeat_stop_sem, 0, 0);
+		(void) retval;
+		assert(retval == 0);
 	}
 
+	~Global()
+	{
+		// the heartbeat thread uses postman, so it must be gone before postman is destroyed
+		stop_heartbeat();
+		sem_destroy(&heartbeat_stop_sem);
+	}
+
+	// connects to the first reachable binder, starting from the one that was reachable last time,
+	// so everyone stays with a standby once it has taken over; returns BINDER_UNAVAILABLE if none is
+	int connect_binder();
+
+	// servers only; started by rpcInit
+	void start_heartbeat();
+	void stop_heartbeat();
+
 	// set and retreive skeletons for servers (only)
 	void update_func_skel(const Function &func, const skeleton &skel);
 	int get_func_skel(const Function &func, std::pair<Function,skeleton> &ret);
 	size_t num_func_registered() const;
 
+	// false if there's no cached answer for func, or the logs applied since have made it stale;
+	// otherwise the cached error, or OK and the next of func's servers, round robin like the binder.
+	// the servers are taken again from the name directory whenever logs have been applied (a KILL_NODE
+	// drops one, a NEW_FUNC adds one); an error is used only while the name directory hasn't changed
+	bool find_location(const Function &func, int &retval, unsigned &server_id);
+	// server_id is the binder's suggestion; the cached calls go on from the server after it
+	void cache_location(const Function &func, int retval, unsigned server_id);
+
+	// apply the directory changes that have been pushed so far; does not block
+	void drain_watch();
+	bool is_watch_push(const Postman::Request &req) const;
+
 	// desired contains flags of Postman::MessageType
 	int wait_for_desired(int desired, Postman::Request &ret, int *need_alive_fd = NULL);
 
@@ -96,6 +196,17 @@ int rpcInit()
 		return NOT_A_SERVER;
 	}
 
+	// the calling thread runs the receive loop in rpcExecute; pin it before any
+	// connection state is allocated, so that state is first-touched on the local NUMA node
+	cpu_set_t io_cpus;
+	CPU_ZERO(&g.process_cpus);
+	sched_getaffinity(0, sizeof(g.process_cpus), &g.process_cpus);
+
+	if(get_cpu_list("RPC_IO_CPUS", io_cpus) < 0 || pin_thread(pthread_self(), io_cpus) < 0)
+	{
+		return INVALID_CPU_LIST;
+	}
+
 	g.server_fd = g.postman.bind_and_listen();
 
 	if(g.server_fd < 0)
@@ -110,7 +221,7 @@ int rpcInit()
 #ifndef NDEBUG
 	print_host_info(g.server_fd,"SERVER");
 #endif
-	ScopedConnection conn(g.postman, g.binder_hostname, g.binder_port);
+	ScopedConnection conn(g.postman, g.connect_binder());
 	int binder_fd = conn.get_fd();
 
 	if(binder_fd < 0)
@@ -139,14 +250,98 @@ int rpcInit()
 	g.ns.apply_logs(ss);
 	// resolve "my" own name for future uses
 	g.ns.resolve(g.server_id, g.server_name);
+	// the binder gives up on servers that don't send heartbeats
+	g.start_heartbeat();
 	return OK;
 }
 
+static void *run_heartbeat(void *data)
+{
+	(void) data;
+	long interval_ms = get_env_long("RPC_HEARTBEAT_INTERVAL", HEARTBEAT_INTERVAL);
+	// persistent control connection to the binder; reconnected whenever it drops
+	int binder_fd = -1;
+	unsigned conn_id = 0;
+
+	while(true)
+	{
+		if(!g.postman.is_alive(binder_fd, conn_id))
+		{
+			binder_fd = g.connect_binder();
+			conn_id = binder_fd >= 0 ? g.postman.get_conn_id(binder_fd) : 0;
+		}
+
+		if(binder_fd >= 0)
+		{
+			// ignore error -- the binder may be restarting
+			g.postman.send_heartbeat(binder_fd, conn_id, g.server_id);
+		}
+
+		struct timespec deadline;
+		deadline_after(interval_ms, deadline);
+
+		if(sem_timedwait(&g.heartbeat_stop_sem, &deadline) == 0)
+		{
+			// woken up by stop_heartbeat()
+			break;
+		}
+	}
+
+	if(g.postman.is_alive(binder_fd, conn_id))
+	{
+		g.postman.disconnect(binder_fd);
+	}
+
+	return NULL;
+}
+
+int Global::connect_binder()
+{
+	unsigned first = this->binder_index;
+
+	for(size_t i = 0; i < this->binder_hostnames.size(); i++)
+	{
+		unsigned index = (first + i) % this->binder_hostnames.size();
+		int fd = this->postman.connect_remote(this->binder_hostnames[index].c_str(), this->binder_ports[index]);
+
+		if(fd >= 0)
+		{
+			this->binder_index = index;
+			return fd;
+		}
+	}
+
+	return BINDER_UNAVAILABLE;
+}
+
+void Global::start_heartbeat()
+{
+	assert(!this->has_heartbeat);
+	int retval = pthread_create(&this->heartbeat_thread, NULL, &run_heartbeat, NULL);
+	(void) retval;
+	assert(retval == 0);
+	this->has_heartbeat = true;
+}
+
+void Global::stop_heartbeat()
+{
+	if(!this->has_heartbeat)
+	{
+		return;
+	}
+
+	sem_post(&this->heartbeat_stop_sem);
+	pthread_join(this->heartbeat_thread, NULL);
+	this->has_heartbeat = false;
+}
+
 int Global::rpc_call_helper(Name &server_name, Function &func, void **args, bool is_force_server_run)
 {
+	long start_us = now_us();
 	ScopedConnection target_conn(g.postman, server_name.ip, server_name.port);
 	int target_fd = target_conn.get_fd();
 	int retval;
+	Tracer::get().span(get_trace_id(), "connect", start_us, now_us(), to_format(server_name));
 
 	if(target_fd < 0)
 	{
@@ -154,6 +349,7 @@ int Global::rpc_call_helper(Name &server_name, Function &func, void **args, bool
 		return CANNOT_CONNECT_TO_SERVER;
 	}
 
+	ScopedSpan span("EXECUTE", func.name);
 	retval = g.postman.send_execute(target_fd, func, args, is_force_server_run);
 
 	if(retval < 0)
@@ -178,75 +374,83 @@ int Global::rpc_call_helper(Name &server_name, Function &func, void **args, bool
 	// only has output when the RPC call is successful
 	if(retval >= 0)
 	{
-		for(size_t i = 0; i < func.types.size(); i++)
-		{
-			int arg_type = func.types[i];
-			size_t cardinality = get_arg_car(arg_type);
-
-			if(is_arg_output(arg_type))
-			{
-				switch(get_arg_data_type(arg_type))
-				{
-					case ARG_CHAR:
-						for(size_t j = 0; j < cardinality; j++)
-						{
-							((char*)args[i])[j] = pop_i8(ss);
-						}
-
-						break;
-
-					case ARG_SHORT:
-						for(size_t j = 0; j < cardinality; j++)
-						{
-							short *argi = reinterpret_cast<short*>(args[i]);
-							argi[j] = pop_i16(ss);
-						}
-
-						break;
-
-					case ARG_INT:
-						for(size_t j = 0; j < cardinality; j++)
-						{
-							int *argi = reinterpret_cast<int*>(args[i]);
-							argi[j] = pop_i32(ss);
-						}
-
-						break;
-
-					case ARG_LONG:
-						for(size_t j = 0; j < cardinality; j++)
-						{
-							long *argi = reinterpret_cast<long*>(args[i]);
-							argi[j] = pop_i64(ss);
-						}
-
-						break;
-
-					case ARG_DOUBLE:
-						for(size_t j = 0; j < cardinality; j++)
-						{
-							double *argi = reinterpret_cast<double*>(args[i]);
-							argi[j] = pop_f64(ss);
-						}
-
-						break;
-
-					case ARG_FLOAT:
-						for(size_t j = 0; j < cardinality; j++)
-						{
-							float *argi = reinterpret_cast<float*>(args[i]);
-							argi[j] = pop_f32(ss);
-						}
-
-						break;
-				}
-			}
-		}
+		pop_args(ss, func, args, true);
 	}
 
 	return retval;
 }
 
+bool Global::find_location(const Function &func, int &retval, unsigned &server_id)
+{
+	Location *location = this->locations.find(func);
+
+	if(location == NULL)
+	{
+		return false;
+	}
+
+	// read before the servers, so a change that lands in between is picked up next time
+	unsigned version = this->ns.get_version();
+
+	if(location->retval >= 0 && location->ns_version != version)
+	{
+		location->server_ids = this->ns.get_servers(func);
+		location->ns_version = version;
+	}
+
+	bool is_valid = now_ms() < location->expires_ms
+	                && (location->retval < 0
+	                    ? location->ns_version == version
+	                    : !location->server_ids.empty());
+
+	if(!is_valid)
+	{
+		// expired, an error from an older name directory, or all the servers are gone
+		this->locations.erase(func);
+		return false;
+	}
+
+	retval = location->retval;
+
+	if(retval >= 0)
+	{
+		server_id = location->server_ids[location->next++ % location->server_ids.size()];
+	}
+
+	return true;
+}
+
+void Global::cache_location(const Function &func, int retval, unsigned server_id)
+{
+	long ttl_ms = (retval < 0) ? this->no_server_ttl_ms : this->location_ttl_ms;
+
+	if(ttl_ms == 0)
+	{
+		return;
+	}
+
+	Location location;
+	location.retval = retval;
+	location.next = 0;
+	location.expires_ms = now_ms() + ttl_ms;
+	location.ns_version = this->ns.get_version();
+
+	if(retval >= 0)
+	{
+		location.server_ids = this->ns.get_servers(func);
+		NameService::NameIds::iterator it = std::find(location.server_ids.begin(), location.server_ids.end(), server_id);
+		location.next = it == location.server_ids.end() ? 0 : it - location.server_ids.begin() + 1;
+	}
+
+	this->locations[func] = location;
+}
+
+// the call never reached a server, so asking the binder again is safe
+static bool is_connection_failure(int retval)
+{
+	return retval == CANNOT_CONNECT_TO_SERVER || retval == REMOTE_DISCONNECTED || retval == CANNOT_WRITE_TO_SOCKET;
+}
+
 int rpcCall(char* name, int* argTypes, void** args)
 {
 #ifndef NDEBUG
@@ -271,12 +475,39 @@ int rpcCall(char* name, int* argTypes, void** args)
 		return FUNCTION_ARGTYPES_INVALID;
 	}
 
+	// a new trace, unless rpcCacheCall has started one
+	ScopedTrace trace("rpcCall", name);
 	int retval;
 	Postman::Request req;
 	Function func = to_function(name, argTypes);
+	// skip the binder if it has answered recently; pushed changes may invalidate the answer
+	unsigned server_id;
+	g.drain_watch();
+
+	if(g.find_location(func, retval, server_id))
+	{
+		if(retval < 0)
+		{
+			return retval;
+		}
+
+		Name server_name;
+		g.ns.resolve(server_id, server_name);
+		retval = g.rpc_call_helper(server_name, func, args);
+
+		if(!is_connection_failure(retval))
+		{
+			return retval;
+		}
+
+		// the server has gone away since
+		g.locations.erase(func);
+	}
+
 	// send a location request to the binder
 	{
-		ScopedConnection conn(g.postman, g.binder_hostname, g.binder_port);
+		ScopedSpan span("LOC_REQUEST", func.name);
+		ScopedConnection conn(g.postman, g.connect_binder());
 		int binder_fd = conn.get_fd();
 
 		if(binder_fd < 0)
@@ -316,10 +547,12 @@ int rpcCall(char* name, int* argTypes, void** args)
 			return retval;
 		}
 
+		g.cache_location(func, OK, target_id);
 		return g.rpc_call_helper(name, func, args);
 	}
 
 	retval = pop_i32(ss);
+	g.cache_location(func, retval, 0);
 	return retval;
 }
 
@@ -347,11 +580,14 @@ int rpcCacheCall(char* name, int* argTypes, void** args)
 		return FUNCTION_NAME_IS_INVALID;
 	}
 
+	ScopedTrace trace("rpcCacheCall", name);
 	unsigned server_id;
 	Function func = to_function(name, argTypes);
 	std::set<unsigned> duplicates;
+	// don't suggest servers that the binder has already declared dead
+	g.drain_watch();
 
-	while(g.ns.suggest(g.postman, func, server_id, false) >= 0)
+	while(g.ns.suggest(func, server_id) >= 0)
 	{
 		Name server_name;
 
@@ -435,7 +671,7 @@ int rpcRegister(char* name, int* argTypes, skeleton f)
 		return SKELETON_UPDATED;
 	}
 
-	ScopedConnection conn(g.postman, g.binder_hostname, g.binder_port);
+	ScopedConnection conn(g.postman, g.connect_binder());
 	int binder_fd = conn.get_fd();
 
 	if(binder_fd < 0)
@@ -493,9 +729,24 @@ int rpcExecute()
 		return EXECUTE_WITHOUT_REGISTER;
 	}
 
+	cpu_set_t worker_cpus, allowed_cpus;
+
+	if(get_cpu_list("RPC_WORKER_CPUS", worker_cpus) < 0)
+	{
+		return INVALID_CPU_LIST;
+	}
+
+	// offline cpus, or ones outside the process's mask (taskset, cgroups), can't take a worker
+	CPU_AND(&allowed_cpus, &worker_cpus, &g.process_cpus);
+
+	if(!CPU_EQUAL(&allowed_cpus, &worker_cpus))
+	{
+		return INVALID_CPU_LIST;
+	}
+
 	int retval;
 	{
-		ScopedConnection conn(g.postman, g.binder_hostname, g.binder_port);
+		ScopedConnection conn(g.postman, g.connect_binder());
 		int binder_fd = conn.get_fd();
 		assert(binder_fd != -1); // something must be very wrong if the binder is down
 
@@ -506,7 +757,13 @@ int rpcExecute()
 		}
 	}
 	// used by the server to run tasks on a thread pool
-	Tasks tasks;
+	Tasks tasks(worker_cpus, g.process_cpus);
+
+	if(tasks.get_num_threads() == 0)
+	{
+		tasks.terminate();
+		return INVALID_CPU_LIST;
+	}
 
 	// only the server calls this methods, and hello is sent during init()
 	while(!g.is_terminate)
@@ -528,28 +785,109 @@ int rpcExecute()
 
 		if(retval < 0)
 		{
-			return g.postman.reply_execute(remote_fd, FUNCTION_NOT_REGISTERED, func, NULL, remote_ns_version);
+			return g.postman.reply_execute(remote_fd, req.conn_id, FUNCTION_NOT_REGISTERED, func, NULL, remote_ns_version);
 		}
 		else
 		{
-			// copy input
+			// copy input; the arrays are as long as the caller's, not the registered ones
 			std::string data(req.message.str.substr(ss.tellg()));
-			Tasks::Task t(g.postman, remote_fd, g.server_name, func_info.first, func_info.second, data, remote_ns_version);
+			Tasks::Task t(g.postman, remote_fd, req.conn_id, g.server_name, func, func_info.second, data, remote_ns_version,
+			              req.message.trace_id, req.received_us);
 
 			// push call to the task queue and let other threads to handle it
 			if(!tasks.push(t, is_force_queue_task))
 			{
-				g.postman.reply_execute(remote_fd, SERVER_HAS_NO_AVAIL_THREADS, func, NULL, remote_ns_version);
+				g.postman.reply_execute(remote_fd, req.conn_id, SERVER_HAS_NO_AVAIL_THREADS, func, NULL, remote_ns_version);
 			}
 		}
 	}
 
 	// kill all threads
 	tasks.terminate();
+	g.stop_heartbeat();
 	// server terminates gracefully
 	return OK;
 }
 
+int rpcWatch()
+{
+#ifndef NDEBUG
+	std::cout << "RPC WATCH" << std::endl;
+#endif
+
+	if(g.server_id != -1)
+	{
+		return NOT_A_CLIENT;
+	}
+
+	g.has_run_calls = true;
+
+	if(g.watch_fd >= 0 && g.postman.is_alive(g.watch_fd, g.watch_conn_id))
+	{
+		// already watching
+		return OK;
+	}
+
+	// not a scoped connection: the binder pushes to it until the client exits
+	int binder_fd = g.connect_binder();
+
+	if(binder_fd < 0)
+	{
+		return BINDER_UNAVAILABLE;
+	}
+
+	Postman::Request req;
+	int retval = g.postman.send_watch(binder_fd);
+
+	if(retval >= 0)
+	{
+		// the first push is the reply
+		retval = g.wait_for_desired(Postman::NS_UPDATE_SENT, req, &binder_fd);
+	}
+
+	if(retval < 0)
+	{
+		g.postman.disconnect(binder_fd);
+		return retval;
+	}
+
+	std::stringstream ss(req.message.str);
+	g.ns.apply_logs(ss);
+	g.watch_fd = binder_fd;
+	g.watch_conn_id = g.postman.get_conn_id(binder_fd);
+	return OK;
+}
+
+bool Global::is_watch_push(const Postman::Request &req) const
+{
+	return this->watch_fd >= 0 && req.fd == this->watch_fd && req.conn_id == this->watch_conn_id
+	       && req.message.msg_type == Postman::NS_UPDATE_SENT;
+}
+
+void Global::drain_watch()
+{
+	Postman::Request req;
+
+	while(this->watch_fd >= 0 && this->postman.poll_and_receive_any(req) >= 0)
+	{
+		// clients don't get anything else unsolicited
+		if(this->is_watch_push(req))
+		{
+			std::stringstream ss(req.message.str);
+			this->ns.apply_logs(ss);
+		}
+	}
+
+	if(this->watch_fd >= 0 && !this->postman.is_alive(this->watch_fd, this->watch_conn_id))
+	{
+		// e.g. the binder has gone away; fall back to the logs that ride on replies
+#ifndef NDEBUG
+		std::cout << "lost the watch connection" << std::endl;
+#endif
+		this->watch_fd = -1;
+	}
+}
+
 int rpcTerminate()
 {
 #ifndef NDEBUG
@@ -561,7 +899,7 @@ int rpcTerminate()
 		return NOT_A_CLIENT;
 	}
 
-	ScopedConnection conn(g.postman, g.binder_hostname, g.binder_port);
+	ScopedConnection conn(g.postman, g.connect_binder());
 	int binder_fd = conn.get_fd();
 
 	if(binder_fd < 0)
@@ -601,10 +939,34 @@ int Global::get_func_skel(const Function &func, std::pair<Function,skeleton> &re
 	return OK;
 }
 
+// a reply must come from need_alive_fd: nested waits (back-to-back NEW_SERVER_EXECUTE) wait for
+// NS_UPDATE_SENT on different connections; CONFIRM_TERMINATE is the exception, since the binder
+// sends it on the TERMINATE connection
+// replies that a nested wait can get on behalf of an outer one
+static const int REPLY_TYPES = Postman::NS_UPDATE_SENT | Postman::SERVER_OK | Postman::REGISTER_DONE
+                               | Postman::LOC_REPLY | Postman::EXECUTE_REPLY;
+
+static bool is_desired(int desired, const Postman::Request &req, int *need_alive_fd)
+{
+	return (req.message.msg_type & desired) != 0
+	       && (need_alive_fd == NULL || req.fd == *need_alive_fd || req.message.msg_type == Postman::CONFIRM_TERMINATE);
+}
+
 int Global::wait_for_desired(int desired, Postman::Request &ret, int *need_alive_fd)
 {
 	while(!this->is_terminate)
 	{
+		// a nested wait may have put it aside
+		for(std::deque<Postman::Request>::iterator it = this->deferred.begin(); it != this->deferred.end(); it++)
+		{
+			if(is_desired(desired, *it, need_alive_fd))
+			{
+				ret = *it;
+				this->deferred.erase(it);
+				return OK;
+			}
+		}
+
 		if(need_alive_fd != NULL && !postman.is_alive(*need_alive_fd))
 		{
 			// need-alive target has been disconnected, so error
@@ -616,12 +978,27 @@ int Global::wait_for_desired(int desired, Postman::Request &ret, int *need_alive
 			continue;
 		}
 
+		if(this->is_watch_push(ret) && (need_alive_fd == NULL || *need_alive_fd != this->watch_fd))
+		{
+			// arrived while waiting for something else
+			std::stringstream ss(ret.message.str);
+			this->ns.apply_logs(ss);
+			continue;
+		}
+
 		// got the desired type(s) of request
-		if((ret.message.msg_type & desired) != 0)
+		if(is_desired(desired, ret, need_alive_fd))
 		{
 			return OK;
 		}
 
+		if(need_alive_fd != NULL && (ret.message.msg_type & REPLY_TYPES) != 0)
+		{
+			// the reply of an outer wait, e.g. REGISTER_DONE while NEW_SERVER_EXECUTE asks for updates
+			this->deferred.push_back(ret);
+			continue;
+		}
+
 		int remote_fd = ret.fd;
 		unsigned remote_ns_version = ret.message.ns_version;
 		std::stringstream ss(ret.message.str);
@@ -639,7 +1016,7 @@ int Global::wait_for_desired(int desired, Postman::Request &ret, int *need_alive
 				// the server got a TERMINATE request, but the only thing we know
 				// about the binder is the hostname and the listening port -- we can't
 				// trust the port that is used to send this message.
-				ScopedConnection conn(postman, binder_hostname, binder_port);
+				ScopedConnection conn(postman, this->connect_binder());
 				int binder_fd = conn.get_fd();
 
 				if(binder_fd < 0)
@@ -670,7 +1047,7 @@ int Global::wait_for_desired(int desired, Postman::Request &ret, int *need_alive
 
 			case Postman::NEW_SERVER_EXECUTE:
 			{
-				ScopedConnection conn(postman, binder_hostname, binder_port);
+				ScopedConnection conn(postman, this->connect_binder());
 				int binder_fd = conn.get_fd();
 				assert(binder_fd != -1); // something is wrong...
 
@@ -698,6 +1075,16 @@ int Global::wait_for_desired(int desired, Postman::Request &ret, int *need_alive
 				this->ns.apply_logs(ss);
 				break;
 
+			case Postman::STATS:
+				this->postman.reply_stats(remote_fd);
+				break;
+
+			case Postman::EXECUTE:
+				// a client called while a nested wait (e.g. NEW_SERVER_EXECUTE above) is in progress;
+				// keep it for the wait_for_desired() in rpcExecute
+				this->deferred.push_back(ret);
+				break;
+
 			default:
 				// unreachable -- cannot have other requests
 				assert(false);
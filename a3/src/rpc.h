@@ -27,6 +27,9 @@ extern int rpcRegister(char* name, int* argTypes, skeleton f);
 extern int rpcExecute();
 extern int rpcTerminate();
 
+/* optional, clients only: the binder pushes name directory changes, which keeps rpcCacheCall's candidates fresh */
+extern int rpcWatch();
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,143 @@
+#include "debug.hpp"
+#include "metrics.hpp"
+#include "name_service.hpp"
+#include "postman.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+// asks a live binder or server for its Metrics (STATS) and prints them
+// usage: rpcstat [address port]; the default is the first binder of BINDER_ADDRESS/BINDER_PORT
+
+static const long STATS_TIMEOUT = 3000;
+
+static std::string first_of_list(const char *list)
+{
+	std::string ret(list == NULL ? "" : list);
+	return ret.substr(0, ret.find(','));
+}
+
+// the upper bound (in microseconds) of the bucket that holds the p-th quantile
+static long get_quantile(const Metrics::Counters &counters, double p)
+{
+	uint64_t total = 0;
+
+	for(size_t i = 0; i < Metrics::NUM_BUCKETS; i++)
+	{
+		total += counters.wait_us[i];
+	}
+
+	uint64_t seen = 0;
+
+	for(size_t i = 0; i < Metrics::NUM_BUCKETS; i++)
+	{
+		seen += counters.wait_us[i];
+
+		if(total > 0 && seen >= p * total)
+		{
+			return 1L << i;
+		}
+	}
+
+	return 0;
+}
+
+static void print_snapshot(const Metrics::Snapshot &snapshot)
+{
+	std::cout << "incoming queue " << snapshot.incoming_depth << " (max " << snapshot.incoming_max_depth << ")"
+	          << ", outgoing queue " << snapshot.outgoing_depth << std::endl;
+	std::cout << std::left << std::setw(20) << "type" << std::right
+	          << std::setw(10) << "in" << std::setw(10) << "out"
+	          << std::setw(14) << "bytes_in" << std::setw(14) << "bytes_out"
+	          << std::setw(12) << "wait_p50<" << std::setw(12) << "wait_p99<" << std::setw(12) << "wait_max<"
+	          << std::endl;
+
+	for(size_t i = 0; i < Metrics::NUM_TYPES; i++)
+	{
+		const Metrics::Counters &counters = snapshot.types[i];
+
+		if(counters.msgs_in == 0 && counters.msgs_out == 0)
+		{
+			continue;
+		}
+
+		std::cout << std::left << std::setw(20) << message_type_name(1 << i) << std::right
+		          << std::setw(10) << counters.msgs_in << std::setw(10) << counters.msgs_out
+		          << std::setw(14) << counters.bytes_in << std::setw(14) << counters.bytes_out
+		          << std::setw(12) << get_quantile(counters, 0.5) << std::setw(12) << get_quantile(counters, 0.99)
+		          << std::setw(12) << get_quantile(counters, 1) << std::endl;
+	}
+
+	// the histograms themselves: "upper bound in us:count" of the buckets in use
+	for(size_t i = 0; i < Metrics::NUM_TYPES; i++)
+	{
+		const Metrics::Counters &counters = snapshot.types[i];
+		bool is_empty = true;
+
+		for(size_t j = 0; j < Metrics::NUM_BUCKETS; j++)
+		{
+			if(counters.wait_us[j] == 0)
+			{
+				continue;
+			}
+
+			if(is_empty)
+			{
+				std::cout << message_type_name(1 << i) << " wait(us)";
+				is_empty = false;
+			}
+
+			std::cout << " <" << (1L << j) << ":" << counters.wait_us[j];
+		}
+
+		if(!is_empty)
+		{
+			std::cout << std::endl;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	std::string address = argc > 2 ? argv[1] : first_of_list(getenv("BINDER_ADDRESS"));
+	int port = atoi(argc > 2 ? argv[2] : first_of_list(getenv("BINDER_PORT")).c_str());
+
+	if(address.empty() || port <= 0)
+	{
+		std::cerr << "usage: " << argv[0] << " [address port]" << std::endl;
+		return 1;
+	}
+
+	NameService ns;
+	Postman postman(ns);
+	ScopedConnection conn(postman, address.c_str(), port);
+	int fd = conn.get_fd();
+
+	if(fd < 0 || postman.send_stats(fd) < 0)
+	{
+		std::cerr << "cannot reach " << address << ":" << port << std::endl;
+		return 1;
+	}
+
+	long deadline_ms = now_ms() + STATS_TIMEOUT;
+
+	while(now_ms() < deadline_ms && postman.is_alive(fd))
+	{
+		Postman::Request req;
+
+		if(postman.poll_and_receive_any(req, 100) < 0 || req.message.msg_type != Postman::STATS_REPLY)
+		{
+			continue;
+		}
+
+		std::stringstream ss(req.message.str);
+		Metrics::Snapshot snapshot;
+		snapshot_from_sstream(ss, snapshot);
+		print_snapshot(snapshot);
+		return 0;
+	}
+
+	std::cerr << "no reply from " << address << ":" << port << std::endl;
+	return 1;
+}
@@ -4,8 +4,10 @@
 #include <cassert>
 #include <cstring>
 #include <errno.h>
+#include <fcntl.h>
 #include <iostream>
 #include <netdb.h>
+#include <poll.h>
 #include <unistd.h>
 #include <sys/time.h>
 
@@ -16,8 +18,15 @@ int TCP::Sockets::create_socket()
 
 TCP::Sockets::Sockets()
 	: local_fd(-1),
+	  next_conn_id(0),
 	  buffer(NULL)
 {
+	int retval = pipe(this->wake_fds);
+	(void) retval;
+	// should not happen in the student environment
+	assert(retval == 0);
+	fcntl(this->wake_fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(this->wake_fds[1], F_SETFL, O_NONBLOCK);
 }
 
 TCP::Sockets::~Sockets()
@@ -38,6 +47,9 @@ TCP::Sockets::~Sockets()
 	{
 		close(this->local_fd);
 	}
+
+	close(this->wake_fds[0]);
+	close(this->wake_fds[1]);
 }
 
 int TCP::Sockets::bind_and_listen(int port, int num_listen)
@@ -59,6 +71,9 @@ int TCP::Sockets::bind_and_listen(int port, int num_listen)
 	socket_info.sin_addr.s_addr = htonl(INADDR_ANY);
 
 	socket_info.sin_port = htons(port);
+	// so a restarted binder can take its old port back while old connections are in TIME_WAIT
+	int on = 1;
+	setsockopt(temp_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
 
 	if(bind(temp_fd, (struct sockaddr*) &socket_info, sizeof(socket_info)) < 0)
 	{
@@ -83,9 +98,13 @@ int TCP::Sockets::bind_and_listen(int port, int num_listen)
 
 void TCP::Sockets::setup_read_fds(fd_set &fds) const
 {
-	// similar to write fds, except read fds also need socket_fd (to check for incoming connections)
-	this->setup_write_fds(fds);
-	FD_SET(this->local_fd, &fds);
+	FD_ZERO(&fds);
+
+	// includes socket_fd (to check for incoming connections)
+	for(Fds::iterator it = this->connected_fds.begin(); it != this->connected_fds.end(); it++)
+	{
+		FD_SET(*it, &fds);
+	}
 }
 
 void TCP::Sockets::setup_write_fds(fd_set &fds) const
@@ -94,14 +113,14 @@ void TCP::Sockets::setup_write_fds(fd_set &fds) const
 
 	for(Fds::iterator it = this->connected_fds.begin(); it != this->connected_fds.end(); it++)
 	{
-		if(*it != this->local_fd)
+		if(*it != this->local_fd && (this->unsent.count(*it) > 0 || (this->buffer != NULL && this->buffer->is_write_avail(*it))))
 		{
 			FD_SET(*it, &fds);
 		}
 	}
 }
 
-int TCP::Sockets::sync()
+int TCP::Sockets::sync(pthread_mutex_t *mutex, long timeout_ms)
 {
 	if(num_connected() == 0)
 	{
@@ -111,90 +130,110 @@ int TCP::Sockets::sync()
 	fd_set readfds, writefds;
 	setup_read_fds(readfds);
 	setup_write_fds(writefds);
-	int max_fd = this->get_max_fd();
+	FD_SET(this->wake_fds[0], &readfds);
+	int max_fd = std::max(this->get_max_fd(), this->wake_fds[0]);
 	char buf[SOCKET_BUF_SIZE];
 	struct timeval time;
-	time.tv_sec = 1;
-	time.tv_usec = 0;
-	int retval = select(max_fd + 1, &readfds, &writefds, NULL, &time);
+	time.tv_sec = timeout_ms / 1000;
+	time.tv_usec = (timeout_ms % 1000) * 1000;
+	// remember which connection each fd referred to, because fds can be
+	// closed and reused by other threads while select() is unlocked
+	ConnIds local_copy = this->conn_ids;
 
-	if(retval < 0 && errno != EINTR)
+	if(mutex != NULL)
 	{
-		// some error occurred
-		return retval;
+		pthread_mutex_unlock(mutex);
 	}
 
-	Fds local_copy;
-	local_copy = this->connected_fds;
+	int retval = select(max_fd + 1, &readfds, &writefds, NULL, &time);
 
-	for(Fds::iterator it = local_copy.begin(); it != local_copy.end(); it++)
+	if(mutex != NULL)
 	{
-		int fd = *it;
+		pthread_mutex_lock(mutex);
+	}
 
-		if(FD_ISSET(fd, &readfds))
-		{
-			// in other words, this is the server and is listening for new client connections
-			// -1 means the server hasn't called bind_and_listen
-			assert(this->local_fd != -1 || this->local_fd != fd);
+	if(retval < 0)
+	{
+		// EBADF: an fd was closed by another thread during select(); try again next time
+		return (errno == EINTR || errno == EBADF) ? OK : retval;
+	}
 
-			if(fd == this->local_fd)
-			{
-				int remote_fd = accept(this->local_fd, NULL, NULL);
+	if(FD_ISSET(this->wake_fds[0], &readfds))
+	{
+		// drain the wake-up bytes; they carry no data
+		while(read(this->wake_fds[0], buf, sizeof(buf)) > 0);
+	}
 
-				if(remote_fd < 0)
-				{
-					// this should not happen in the student environment
-					assert(false);
-					return CANNOT_ACCEPT_CONNECTION;
-				}
+	// in other words, this is the server and is listening for new client connections
+	// -1 means the server hasn't called bind_and_listen
+	if(this->local_fd != -1 && FD_ISSET(this->local_fd, &readfds))
+	{
+		int remote_fd = accept(this->local_fd, NULL, NULL);
 
-				bool inserted = this->connected_fds.insert(remote_fd).second;
-				// supress warning when compiling with NDEBUG
-				(void) inserted;
-				// fds must be unique; something is wrong here
-				assert(inserted);
+		if(remote_fd < 0)
+		{
+			// this should not happen in the student environment
+			assert(false);
+			return CANNOT_ACCEPT_CONNECTION;
+		}
+
+		this->add_remote(remote_fd);
 #ifndef NDEBUG
-				std::cout << "connected " << remote_fd << std::endl;
+		std::cout << "connected " << remote_fd << std::endl;
 #endif
+	}
+
+	for(ConnIds::iterator it = local_copy.begin(); it != local_copy.end(); it++)
+	{
+		int fd = it->first;
+
+		if(!this->is_alive(fd, it->second))
+		{
+			// disconnected (and maybe reused) while select() was unlocked
+			continue;
+		}
+
+		if(FD_ISSET(fd, &readfds))
+		{
+			int count = read(fd, buf, sizeof(buf));
+
+			if(count == 0 || (count < 0 && errno != EINTR && errno != EAGAIN))
+			{
+				// remote sent EOF (or reset the connection) -- disconnect remote
+				this->disconnect(fd);
+				continue;
 			}
-			else
+			else if(count > 0)
 			{
-				int count = read(fd, buf, sizeof(buf));
+				std::string buf_str(buf, count);
 
-				if(count == 0)
+				if(this->buffer != NULL)
 				{
-					// remote sent EOF -- disconnect remote
-					this->disconnect(fd);
-					break; // iterators invalidated
-				}
-				else if(count > 0)
-				{
-					std::string buf_str(buf, count);
-
-					if(this->buffer != NULL)
-					{
-						// notify the buffer
-						this->buffer->read_avail(fd, buf_str);
-					}
+					// notify the buffer
+					this->buffer->read_avail(fd, buf_str);
 				}
 			}
 		}
 
 		if(FD_ISSET(fd, &writefds))
 		{
-			if(this->connected_fds.find(fd) != this->connected_fds.end())
-			{
-				// double-check in case the fd is closed
-				// ignore return value
-				this->flush(fd);
-			}
+			// ignore return value; sync() never waits for a slow remote
+			this->flush(fd, false);
 		}
 	}
 
 	return OK;
 }
 
-int TCP::Sockets::flush(int dst_fd)
+void TCP::Sockets::wake()
+{
+	// the pipe is non-blocking; if it is full, sync() is going to wake up anyways
+	char c = 0;
+	ssize_t retval = write(this->wake_fds[1], &c, 1);
+	(void) retval;
+}
+
+int TCP::Sockets::flush(int dst_fd, bool is_blocking)
 {
 	// should only write to a REMOTE connection
 	// if local_fd isn't set (i.e. client doesn't bind and listen), then local_fd should be -1 and the assertion should always hold
@@ -207,7 +246,17 @@ int TCP::Sockets::flush(int dst_fd)
 		return OK;
 	}
 
-	const std::string msg = this->buffer->write_avail(dst_fd);
+	// what an earlier non-blocking flush left goes first
+	std::string msg;
+	Unsent::iterator it = this->unsent.find(dst_fd);
+
+	if(it != this->unsent.end())
+	{
+		msg.swap(it->second);
+		this->unsent.erase(it);
+	}
+
+	msg += this->buffer->write_avail(dst_fd);
 
 	if(msg.empty())
 	{
@@ -215,13 +264,20 @@ int TCP::Sockets::flush(int dst_fd)
 		return NOTHING_TO_SEND;
 	}
 
-	char *buf = new char[msg.size()];
-	memcpy(buf, msg.c_str(), msg.size());
-	size_t num_written = write(dst_fd, buf, msg.size());
-	delete [] buf;
+	// MSG_NOSIGNAL: a peer that has gone away must not raise SIGPIPE, e.g. a dead binder on a heartbeat connection
+	ssize_t num_written = ::send(dst_fd, msg.c_str(), msg.size(), MSG_NOSIGNAL | (is_blocking ? 0 : MSG_DONTWAIT));
+
+	if(num_written == static_cast<ssize_t>(msg.size()))
+	{
+		return OK;
+	}
 
-	if(num_written == msg.size())
+	if(!is_blocking && (num_written >= 0 || errno == EAGAIN || errno == EWOULDBLOCK))
 	{
+		// the socket is full; sync() writes the rest once select() finds it writable
+		this->unsent[dst_fd] = msg.substr(std::max(num_written, static_cast<ssize_t>(0)));
+		// a sync() that is already in select() isn't watching dst_fd for writing
+		this->wake();
 		return OK;
 	}
 
@@ -248,8 +304,34 @@ int TCP::Sockets::get_max_fd() const
 
 int TCP::Sockets::connect_remote(const char *hostname, int port)
 {
-	// resolve IP address
 	int ip;
+	int retval = resolve_hostname(hostname, ip);
+
+	if(retval < 0)
+	{
+		return retval;
+	}
+
+	return this->connect_remote(ip, port);
+}
+
+int TCP::Sockets::connect_remote(int ip, int port)
+{
+	int temp_fd = open_remote(ip, port);
+
+	if(temp_fd < 0)
+	{
+		return temp_fd;
+	}
+
+	// connect to remote machine (server) successfully)
+	this->add_remote(temp_fd);
+	return temp_fd;
+}
+
+int TCP::Sockets::resolve_hostname(const char *hostname, int &ip)
+{
+	// resolve IP address
 	struct hostent* server_entity;
 	server_entity = gethostbyname(hostname);
 
@@ -261,16 +343,16 @@ int TCP::Sockets::connect_remote(const char *hostname, int port)
 	}
 
 	memcpy(&ip, server_entity->h_addr, server_entity->h_length);
-	return this->connect_remote(ip, port);
+	return OK;
 }
 
-int TCP::Sockets::connect_remote(int ip, int port)
+int TCP::Sockets::open_remote(int ip, int port, long timeout_ms)
 {
 	struct sockaddr_in remote_info;
 	remote_info.sin_family = AF_INET;
 	remote_info.sin_port = htons(port);
 	memcpy(&remote_info.sin_addr, &ip, sizeof(int));
-	int temp_fd = this->create_socket();
+	int temp_fd = socket(AF_INET, SOCK_STREAM, 0);
 
 	if(temp_fd < 0)
 	{
@@ -278,17 +360,56 @@ int TCP::Sockets::connect_remote(int ip, int port)
 		return BAD_FD;
 	}
 
-	if(connect(temp_fd, (struct sockaddr *)&remote_info, sizeof(remote_info)) < 0)
+	int flags = fcntl(temp_fd, F_GETFL);
+
+	if(timeout_ms >= 0)
+	{
+		fcntl(temp_fd, F_SETFL, flags | O_NONBLOCK);
+	}
+
+	int retval = connect(temp_fd, (struct sockaddr *)&remote_info, sizeof(remote_info));
+
+	if(retval < 0 && errno == EINPROGRESS && timeout_ms >= 0)
+	{
+		struct pollfd pfd = { temp_fd, POLLOUT, 0 };
+		int num_ready = poll(&pfd, 1, timeout_ms);
+
+		if(num_ready == 0)
+		{
+			close(temp_fd);
+			return CONNECT_TIMED_OUT;
+		}
+
+		int error = 0;
+		socklen_t len = sizeof(error);
+
+		if(num_ready > 0 && getsockopt(temp_fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0)
+		{
+			retval = 0;
+		}
+	}
+
+	if(retval < 0)
 	{
 		close(temp_fd);
 		return CANNOT_START_CONNECTION;
 	}
 
-	// connect to remote machine (server) successfully)
-	this->connected_fds.insert(temp_fd);
+	// the rest of Sockets uses blocking sends
+	fcntl(temp_fd, F_SETFL, flags);
 	return temp_fd;
 }
 
+void TCP::Sockets::add_remote(int fd)
+{
+	bool inserted = this->connected_fds.insert(fd).second;
+	// supress warning when compiling with NDEBUG
+	(void) inserted;
+	// fds must be unique; something is wrong here
+	assert(inserted);
+	this->conn_ids[fd] = ++this->next_conn_id;
+}
+
 void TCP::Sockets::disconnect(int fd)
 {
 #ifndef NDEBUG
@@ -303,7 +424,21 @@ void TCP::Sockets::disconnect(int fd)
 	}
 
 	this->connected_fds.erase(it);
+	this->conn_ids.erase(fd);
+	this->unsent.erase(fd);
 	close(fd);
+
+	if(this->buffer != NULL)
+	{
+		// the fd can be reused from now on, so buffered data must be thrown away
+		this->buffer->disconnected(fd);
+	}
+}
+
+size_t TCP::Sockets::get_unsent(int dst_fd) const
+{
+	Unsent::const_iterator it = this->unsent.find(dst_fd);
+	return it == this->unsent.end() ? 0 : it->second.size();
 }
 
 void TCP::Sockets::set_buffer(DataBuffer *buffer)
@@ -316,6 +451,23 @@ bool TCP::Sockets::is_alive(int fd) const
 	return this->connected_fds.find(fd) != this->connected_fds.end();
 }
 
+bool TCP::Sockets::is_alive(int fd, unsigned conn_id) const
+{
+	return conn_id != 0 && this->get_conn_id(fd) == conn_id;
+}
+
+unsigned TCP::Sockets::get_conn_id(int fd) const
+{
+	ConnIds::const_iterator it = this->conn_ids.find(fd);
+
+	if(it == this->conn_ids.end())
+	{
+		return 0;
+	}
+
+	return it->second;
+}
+
 size_t TCP::Sockets::num_connected(int *exclude_fd) const
 {
 	if(exclude_fd != NULL && this->is_alive(*exclude_fd))
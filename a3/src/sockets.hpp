@@ -3,6 +3,7 @@
 
 #include <deque>
 #include <map>
+#include <pthread.h>
 #include <set>
 #include <sstream>
 #include <string>
@@ -36,21 +37,37 @@ public: // typedefs
 		virtual ~DataBuffer() {}
 		virtual void read_avail(int fd, const std::string &got) = 0;
 		virtual const std::string write_avail(int fd) = 0;
+		// whether write_avail(fd) has anything; sync() only asks select() about fds that have something to write
+		virtual bool is_write_avail(int fd) = 0;
+		// called after fd is closed, so per-connection state can be dropped before the fd is reused
+		virtual void disconnected(int fd) = 0;
 	};
 
 	typedef std::set<int> Fds;
 
+	// each connection gets a unique id, so a closed fd that is reused by the OS
+	// can be told apart from the original connection; 0 is never a valid id
+	typedef std::map<int, unsigned> ConnIds;
+
+	// bytes that a non-blocking flush() couldn't write yet, per fd
+	typedef std::map<int, std::string> Unsent;
+
 private: // data
 	int local_fd;
 	Fds connected_fds;
+	ConnIds conn_ids;
+	unsigned next_conn_id;
 	DataBuffer *buffer;
+	Unsent unsent;
+	int wake_fds[2]; // self-pipe that interrupts select() in sync()
 
 private: // functions
 
 	// get the max fd for select()
 	int get_max_fd() const;
 
-	// each time sync() is called, fd_set's are repopulated with these 2 methods
+	// each time sync() is called, fd_set's are repopulated with these 2 methods;
+	// an idle socket is always writable, so only fds with bytes waiting go in the write set
 	void setup_read_fds(fd_set &fds) const;
 	void setup_write_fds(fd_set &fds) const;
 
@@ -67,6 +84,8 @@ public:
 	~Sockets();
 
 	bool is_alive(int fd) const;
+	bool is_alive(int fd, unsigned conn_id) const;
+	unsigned get_conn_id(int fd) const;
 	void disconnect(int fd);
 
 	// this is important -- if the buffer is not set, every incoming messages will be discarded
@@ -79,12 +98,29 @@ public:
 	int connect_remote(const char *hostname, int port);
 	int connect_remote(int ip, int port);
 
+	// connect_remote split in halves, so the blocking connect() can run without external locking:
+	// open_remote() touches no member, and add_remote() inserts the connected fd and assigns it a connection id
+	// note: resolve_hostname() uses gethostbyname(), which is not thread-safe
+	static int resolve_hostname(const char *hostname, int &ip);
+	// a negative timeout blocks until connect() gives up; otherwise CONNECT_TIMED_OUT after timeout_ms
+	static int open_remote(int ip, int port, long timeout_ms = -1);
+	void add_remote(int fd);
+
 	// flush the write buffer directly, BLOCKING (instead of via sync())
-	int flush(int dst_fd);
+	// unless is_blocking is false: then whatever the socket doesn't take is kept and written by sync()
+	int flush(int dst_fd, bool is_blocking = true);
+
+	// the number of bytes of dst_fd that are waiting for sync()
+	size_t get_unsent(int dst_fd) const;
 
 	// send all requests in the write buffer to remote,
 	// and read all incoming messages to the read buffer
-	int sync();
+	// if mutex is given, it must be held by the caller; it is released while blocking in select()
+	// timeout_ms = 0 only polls
+	int sync(pthread_mutex_t *mutex = NULL, long timeout_ms = 1000);
+
+	// make a blocking sync() return early, e.g. after another thread added a connection
+	void wake();
 };
 
 }
@@ -1,20 +1,30 @@
 #include "debug.hpp"
 #include "postman.hpp"
 #include "tasks.hpp"
+#include "trace.hpp"
 #include <cassert>
 #include <cstdlib> // malloc; need to avoid warning for deleting void*
 #include <iostream>
 
 void *run_thread(void *data);
 
-Tasks::Task::Task(Postman &postman, int remote_fd, const Name &remote_name, const Function &func, const skeleton &skel, const std::string &data, int remote_ns_version)
+Tasks::Task::Task(Postman &postman, int remote_fd, unsigned remote_conn_id, const Name &remote_name, const Function &func, const skeleton &skel, const std::string &data, int remote_ns_version,
+                  uint64_t trace_id, long received_us)
 	: postman(postman),
 	  remote_fd(remote_fd),
+	  remote_conn_id(remote_conn_id),
 	  remote_name(remote_name),
 	  func(func),
 	  skel(skel),
 	  data(data),
-	  remote_ns_version(remote_ns_version) {}
+	  remote_ns_version(remote_ns_version),
+	  trace_id(trace_id),
+	  received_us(received_us) {}
+
+bool Tasks::Task::is_wanted() const
+{
+	return this->postman.is_alive(this->remote_fd, this->remote_conn_id);
+}
 
 void Tasks::Task::run()
 {
@@ -22,114 +32,49 @@ void Tasks::Task::run()
 	std::cout << "running........" << std::endl;
 	print_function(this->func);
 #endif
+	// from the socket to a free worker: receive loop, Tasks queue and thread wakeup
+	Tracer &tracer = Tracer::get();
+	long start_us = now_us();
+	tracer.span(this->trace_id, "server queued", this->received_us, start_us, func.name);
+	// the reply carries the request's trace
+	set_trace_id(this->trace_id);
 	void **args = new void*[func.types.size()];
 	int *arg_types = new int[func.types.size() + 1];
 	arg_types[func.types.size()] = 0;
 	std::stringstream ss(this->data);
-	std::vector<void*> malloced;
 
-	// allocate space and collect input into args
+	// allocate space (outputs start zeroed) and collect input into args
 	for(size_t i = 0; i < func.types.size(); i++)
 	{
-		int arg_type = arg_types[i] = func.types[i];
-		bool is_input = is_arg_input(arg_type);
-		size_t cardinality = get_arg_car(arg_type);
-#ifndef NDEBUG
-		std::cout << "car:" << cardinality << " is_input:" << is_input << std::endl;
-#endif
-
-		switch(get_arg_data_type(arg_type))
-		{
-			case ARG_CHAR:
-				args[i] = malloc(cardinality * sizeof(char));
-				malloced.push_back(args[i]);
-
-				for(size_t j = 0; j < cardinality; j++)
-				{
-					char &argsij = ((char*)args[i])[j];
-					argsij = is_input ? pop_i8(ss) : 0;
-				}
-
-				break;
-
-			case ARG_SHORT:
-				args[i] = malloc(cardinality * sizeof(short));
-				malloced.push_back(args[i]);
-
-				for(size_t j = 0; j < cardinality; j++)
-				{
-					short &argsij = ((short*)args[i])[j];
-					argsij = is_input ? pop_i16(ss) : 0;
-				}
-
-				break;
-
-			case ARG_INT:
-				args[i] = malloc(cardinality * sizeof(int));
-				malloced.push_back(args[i]);
-
-				for(size_t j = 0; j < cardinality; j++)
-				{
-					int &argsij = ((int*)args[i])[j];
-					argsij = is_input ? pop_i32(ss) : 0;
-				}
-
-				break;
-
-			case ARG_LONG:
-				args[i] = malloc(cardinality * sizeof(long));
-				malloced.push_back(args[i]);
-
-				for(size_t j = 0; j < cardinality; j++)
-				{
-					long &argsij = ((long*)args[i])[j];
-					argsij = is_input ? pop_i64(ss) : 0;
-				}
-
-				break;
-
-			case ARG_DOUBLE:
-				args[i] = malloc(cardinality * sizeof(double));
-				malloced.push_back(args[i]);
-
-				for(size_t j = 0; j < cardinality; j++)
-				{
-					double &argsij = ((double*)args[i])[j];
-					argsij = is_input ? pop_f64(ss) : 0;
-				}
-
-				break;
-
-			case ARG_FLOAT:
-				args[i] = malloc(cardinality * sizeof(float));
-				malloced.push_back(args[i]);
-
-				for(size_t j = 0; j < cardinality; j++)
-				{
-					float &argsij = ((float*)args[i])[j];
-					argsij = is_input ? pop_f32(ss) : 0;
-				}
-
-				break;
-		}
+		arg_types[i] = func.types[i];
+		args[i] = calloc(get_arg_size(arg_types[i]), 1);
 	}
 
+	pop_args(ss, func, args, false);
+
+	long skel_start_us = now_us();
+	tracer.span(this->trace_id, "unmarshal", start_us, skel_start_us, func.name);
 	int retval = skel(arg_types, args);
+	long skel_end_us = now_us();
+	tracer.span(this->trace_id, "skeleton", skel_start_us, skel_end_us, func.name);
 	delete []arg_types;
 	ErrorNo rpc_retval = retval < 0 ? SKELETON_FAILURE : OK;
-	postman.reply_execute(remote_fd, rpc_retval, func, args, remote_ns_version);
+	// dropped by Postman if the requester disconnected while the skeleton was running
+	postman.reply_execute(remote_fd, remote_conn_id, rpc_retval, func, args, remote_ns_version);
+	tracer.span(this->trace_id, "reply_execute", skel_end_us, now_us(), func.name);
+	set_trace_id(0);
 
-	// clean up memory before sending reply
+	// clean up memory after sending reply
 	for(size_t i = 0; i < func.types.size(); i++)
 	{
-		free(malloced.back());
-		malloced.pop_back();
+		free(args[i]);
 	}
 
 	delete []args;
 }
 
-Tasks::Tasks() :
+Tasks::Tasks(const cpu_set_t &worker_cpus, const cpu_set_t &process_cpus) :
+	num_threads(0),
 	num_tasks_avail(0),
 	is_terminate(false)
 {
@@ -141,10 +86,40 @@ Tasks::Tasks() :
 	retval = pthread_mutex_init(&this->task_lock, NULL);
 	assert(retval == 0);
 
+	int num_cpus = CPU_COUNT(&worker_cpus);
+
 	for(int i = 0; i < MAX_THREADS; i++)
 	{
-		retval = pthread_create(&this->threads[i], NULL, &run_thread, static_cast<void*>(this));
+		pthread_attr_t attr;
+		retval = pthread_attr_init(&attr);
 		assert(retval == 0);
+
+		// one cpu per worker, so workers don't migrate; argument buffers are malloc'ed
+		// by the worker itself, so first-touch places them on the worker's NUMA node
+		// without a list, undo the pinning that this thread got from RPC_IO_CPUS
+		cpu_set_t cpu = process_cpus;
+
+		if(num_cpus > 0)
+		{
+			CPU_ZERO(&cpu);
+			CPU_SET(nth_cpu(worker_cpus, i % num_cpus), &cpu);
+		}
+
+		if(CPU_COUNT(&cpu) > 0)
+		{
+			pthread_attr_setaffinity_np(&attr, sizeof(cpu), &cpu);
+		}
+
+		retval = pthread_create(&this->threads[this->num_threads], &attr, &run_thread, static_cast<void*>(this));
+		pthread_attr_destroy(&attr);
+
+		if(retval != 0)
+		{
+			// e.g. the cpu went offline; rpcExecute checks get_num_threads()
+			break;
+		}
+
+		this->num_threads++;
 	}
 }
 
@@ -156,6 +131,11 @@ Tasks::~Tasks()
 	assert(this->is_terminate);
 }
 
+int Tasks::get_num_threads() const
+{
+	return this->num_threads;
+}
+
 void Tasks::terminate()
 {
 	if(this->is_terminate)
@@ -167,13 +147,13 @@ void Tasks::terminate()
 
 	this->is_terminate = true;
 
-	for(int i = 0; i < MAX_THREADS; i++)
+	for(int i = 0; i < this->num_threads; i++)
 	{
 		// wake up all threads so that they can check is_terminate()
 		sem_post(&this->task_sem);
 	}
 
-	for(int i = 0; i < MAX_THREADS; i++)
+	for(int i = 0; i < this->num_threads; i++)
 	{
 		pthread_join(this->threads[i], NULL);
 	}
@@ -184,7 +164,7 @@ bool Tasks::push(Task &t, bool is_force_queue_task)
 	{
 		ScopedLock lock(this->task_lock);
 
-		if(!is_force_queue_task && this->num_tasks_avail >= MAX_THREADS)
+		if(!is_force_queue_task && this->num_tasks_avail >= this->num_threads)
 		{
 			return false;
 		}
@@ -219,10 +199,23 @@ void *run_thread(void *data)
 		}
 
 		assert(!tasks.tasks.empty());
-		tasks.pop().run();
+		Tasks::Task t = tasks.pop();
+
+		if(t.is_wanted())
+		{
+			t.run();
+		}
+
+#ifndef NDEBUG
+		else
+		{
+			std::cout << "requester disconnected; dropping queued task" << std::endl;
+		}
+
+#endif
+		tasks.finished_a_task();
 	}
 
-	tasks.finished_a_task();
 	return NULL;
 }
 
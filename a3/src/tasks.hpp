@@ -7,6 +7,7 @@
 #include <pthread.h>
 #include <queue>
 #include <semaphore.h>
+#include <stdint.h>
 
 class Postman;
 
@@ -20,20 +21,28 @@ public: // typedefs
 	private: // data
 		Postman &postman;
 		const int remote_fd;
+		const unsigned remote_conn_id; // remote_fd may be reused once the requester disconnects
 		const Name remote_name; // copy
 		const Function func; // copy
 		const skeleton skel; // copy
 		const std::string data; // copy
 		const int remote_ns_version;
+		const uint64_t trace_id; // of the EXECUTE request
+		const long received_us;
 
 	public: // methods
-		Task(Postman &postman, int remote_fd, const Name &name, const Function &func, const skeleton &skel, const std::string &string, int remote_ns_version);
+		Task(Postman &postman, int remote_fd, unsigned remote_conn_id, const Name &name, const Function &func, const skeleton &skel, const std::string &string, int remote_ns_version,
+		     uint64_t trace_id, long received_us);
 		void run();
+
+		// false if the requester has disconnected, i.e. nobody is waiting for the result
+		bool is_wanted() const;
 	};
 
 private: // data
 	std::queue<Task> tasks;
 	pthread_t threads[MAX_THREADS];
+	int num_threads; // started; fewer than MAX_THREADS if pthread_create failed
 	pthread_mutex_t task_lock; // prevent conflict b/w Tasks obj and threads
 	sem_t task_sem; // notify threads
 	int num_tasks_avail;
@@ -44,9 +53,12 @@ private: // methods
 	void finished_a_task();
 
 public: // methods
-	Tasks();
+	// worker i is pinned to the (i mod n)-th cpu of worker_cpus; an empty set means no pinning,
+	// i.e. every worker may run on any of process_cpus (rather than the cpus of the creating thread)
+	Tasks(const cpu_set_t &worker_cpus, const cpu_set_t &process_cpus);
 	~Tasks();
 
+	int get_num_threads() const;
 	void terminate();
 	bool push(Task &t, bool is_force_queue_task);
 
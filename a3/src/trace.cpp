@@ -0,0 +1,170 @@
+#include "common.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <ctime>
+#include <sstream>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+static __thread uint64_t thread_trace_id = 0;
+
+// function names come from users
+static std::string escape_json(const std::string &str)
+{
+	std::string ret;
+
+	for(size_t i = 0; i < str.size(); i++)
+	{
+		if(str[i] == '"' || str[i] == '\\')
+		{
+			ret += '\\';
+		}
+
+		ret += str[i];
+	}
+
+	return ret;
+}
+
+uint64_t get_trace_id()
+{
+	return thread_trace_id;
+}
+
+void set_trace_id(uint64_t trace_id)
+{
+	thread_trace_id = trace_id;
+}
+
+Tracer::Tracer() :
+	file(NULL),
+	every(std::max(get_env_long("RPC_TRACE_EVERY", 1), 1L)),
+	realtime_offset_us(0),
+	num_calls(0),
+	// ids from different processes must not collide
+	next_id((static_cast<uint64_t>(getpid()) << 40) ^ (static_cast<uint64_t>(now_us()) << 8))
+{
+	int retval = pthread_mutex_init(&this->mutex, NULL);
+	(void) retval;
+	assert(retval == 0);
+	const char *prefix = getenv("RPC_TRACE_FILE");
+
+	if(prefix == NULL || *prefix == '\0')
+	{
+		return;
+	}
+
+	// durations still come from the monotonic clock, so they don't jump if the wall clock is set
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	this->realtime_offset_us = ts.tv_sec * 1000000L + ts.tv_nsec / 1000L - now_us();
+
+	std::stringstream path;
+	path << prefix << "." << getpid() << ".json";
+	this->file = fopen(path.str().c_str(), "w");
+
+	if(this->file == NULL)
+	{
+		return;
+	}
+
+	// name the process in the viewer
+	fprintf(this->file, "[{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+	        getpid(), program_invocation_short_name, getpid());
+	fflush(this->file);
+}
+
+Tracer::~Tracer()
+{
+	if(this->file != NULL)
+	{
+		fprintf(this->file, "\n]\n");
+		fclose(this->file);
+	}
+
+	pthread_mutex_destroy(&this->mutex);
+}
+
+Tracer &Tracer::get()
+{
+	static Tracer tracer;
+	return tracer;
+}
+
+bool Tracer::is_on() const
+{
+	return this->file != NULL;
+}
+
+uint64_t Tracer::start_trace()
+{
+	if(!this->is_on())
+	{
+		return 0;
+	}
+
+	ScopedLock lock(this->mutex);
+
+	if(this->num_calls++ % this->every != 0)
+	{
+		return 0;
+	}
+
+	// never 0
+	return ++this->next_id;
+}
+
+void Tracer::span(uint64_t trace_id, const char *name, long start_us, long end_us, const std::string &detail)
+{
+	if(!this->is_on() || trace_id == 0)
+	{
+		return;
+	}
+
+	ScopedLock lock(this->mutex);
+	// one line per event, so a killed process loses at most the last one
+	fprintf(this->file, ",\n{\"name\":\"%s%s%s\",\"cat\":\"rpc\",\"ph\":\"X\",\"ts\":%ld,\"dur\":%ld,"
+	        "\"pid\":%d,\"tid\":%ld,\"args\":{\"trace_id\":\"%016llx\"}}",
+	        name, detail.empty() ? "" : " ", escape_json(detail).c_str(), start_us + this->realtime_offset_us, end_us - start_us,
+	        getpid(), static_cast<long>(syscall(SYS_gettid)), static_cast<unsigned long long>(trace_id));
+	fflush(this->file);
+}
+
+ScopedSpan::ScopedSpan(const char *name, const std::string &detail) :
+	name(name),
+	detail(detail),
+	start_us(now_us()) {}
+
+ScopedSpan::~ScopedSpan()
+{
+	Tracer::get().span(get_trace_id(), this->name, this->start_us, now_us(), this->detail);
+}
+
+ScopedTrace::ScopedTrace(const char *name, const std::string &detail) :
+	is_owner(false),
+	span(NULL)
+{
+	if(get_trace_id() == 0)
+	{
+		set_trace_id(Tracer::get().start_trace());
+		this->is_owner = true;
+	}
+
+	if(get_trace_id() != 0)
+	{
+		this->span = new ScopedSpan(name, detail);
+	}
+}
+
+ScopedTrace::~ScopedTrace()
+{
+	delete this->span;
+
+	if(this->is_owner)
+	{
+		set_trace_id(0);
+	}
+}
@@ -0,0 +1,73 @@
+#ifndef _trace_hpp_
+#define _trace_hpp_
+
+#include <cstdio>
+#include <string>
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+	Optional per-call tracing. A client with RPC_TRACE_FILE set starts a trace for one in
+	RPC_TRACE_EVERY (default 1) of its calls. The trace id goes in the header of every
+	message the calling thread sends, and binders and servers put it on their replies.
+	Every process with RPC_TRACE_FILE set writes the spans of the traces it sees to
+	<RPC_TRACE_FILE>.<pid>.json in Chrome's trace-event format (a JSON array; the closing
+	bracket is optional, so a killed process still leaves a readable file).
+	All public methods are synchronized.
+*/
+class Tracer
+{
+private: // data
+	FILE *file; // NULL when tracing is off
+	long every;
+	// added to now_us() in the file, so spans of different hosts line up (as far as their clocks agree)
+	long realtime_offset_us;
+	unsigned long num_calls;
+	uint64_t next_id;
+	pthread_mutex_t mutex;
+
+private: // methods
+	Tracer();
+	~Tracer();
+
+public: // methods
+	// the process-wide tracer; reads the environment the first time
+	static Tracer &get();
+
+	bool is_on() const;
+
+	// a new trace id, or 0 if this call isn't sampled
+	uint64_t start_trace();
+
+	// timestamps are now_us(); the file gets them in wall-clock time
+	void span(uint64_t trace_id, const char *name, long start_us, long end_us, const std::string &detail = "");
+};
+
+// the trace of the calling thread (0 if none); Postman puts it on outgoing messages
+uint64_t get_trace_id();
+void set_trace_id(uint64_t trace_id);
+
+// a span of the calling thread's trace, from construction to destruction
+class ScopedSpan
+{
+private: // data
+	const char *name;
+	std::string detail;
+	long start_us;
+public: // methods
+	ScopedSpan(const char *name, const std::string &detail = "");
+	~ScopedSpan();
+};
+
+// starts a trace on this thread unless there is one already, and ends it when out of scope
+class ScopedTrace
+{
+private: // data
+	bool is_owner;
+	ScopedSpan *span;
+public: // methods
+	ScopedTrace(const char *name, const std::string &detail);
+	~ScopedTrace();
+};
+
+#endif
@@ -0,0 +1,121 @@
+#include "common.hpp"
+#include "name_service.hpp"
+#include "postman.hpp"
+#include "watchers.hpp"
+#include <algorithm>
+#include <cassert>
+
+#ifndef NDEBUG
+#include <iostream>
+#endif
+
+Watchers::Watchers(Postman &postman)
+	: postman(postman)
+{
+	int retval = pthread_mutex_init(&this->mutex, NULL);
+	(void) retval;
+	assert(retval == 0);
+}
+
+Watchers::~Watchers()
+{
+	pthread_mutex_destroy(&this->mutex);
+}
+
+bool Watchers::push(Entry &entry, unsigned version)
+{
+	if(!this->postman.is_alive(entry.fd, entry.conn_id))
+	{
+		return false;
+	}
+
+	if(this->postman.get_unsent(entry.fd) > WATCHER_MAX_BACKLOG)
+	{
+		// it isn't reading; don't let it hold on to more memory
+		this->postman.disconnect(entry.fd);
+		return false;
+	}
+
+	if(entry.version < version)
+	{
+		// get_logs() may include later entries too; the watcher skips what it already has
+		if(this->postman.push_ns_update(entry.fd, entry.conn_id, entry.version) < 0)
+		{
+			return false;
+		}
+
+		entry.version = version;
+	}
+
+	return true;
+}
+
+void Watchers::add(int fd, unsigned conn_id, unsigned version)
+{
+	ScopedLock lock(this->mutex);
+	Entry entry = { fd, conn_id, version };
+#ifndef NDEBUG
+	std::cout << "new watcher fd:" << fd << " version:" << version << std::endl;
+#endif
+
+	// always reply, so the watcher knows it has subscribed; the reply has at least
+	// the logs up to the version read before sending it
+	unsigned current = this->postman.ns.get_version();
+
+	if(this->postman.push_ns_update(fd, conn_id, version) >= 0)
+	{
+		entry.version = std::max(version, current);
+		this->entries.push_back(entry);
+	}
+}
+
+void Watchers::published(NameService &)
+{
+	this->postman.wake();
+}
+
+void Watchers::push_pending()
+{
+	ScopedLock lock(this->mutex);
+	unsigned version = this->postman.ns.get_version();
+
+	for(size_t i = 0; i < this->entries.size();)
+	{
+		if(this->push(this->entries[i], version))
+		{
+			i++;
+			continue;
+		}
+
+#ifndef NDEBUG
+		std::cout << "watcher fd:" << this->entries[i].fd << " has gone away" << std::endl;
+#endif
+		this->entries[i] = this->entries.back();
+		this->entries.pop_back();
+	}
+}
+
+void Watchers::terminate()
+{
+	ScopedLock lock(this->mutex);
+
+	for(size_t i = 0; i < this->entries.size(); i++)
+	{
+		if(!this->postman.is_alive(this->entries[i].fd, this->entries[i].conn_id))
+		{
+			continue;
+		}
+
+		if(this->postman.get_unsent(this->entries[i].fd) > 0)
+		{
+			// it isn't reading, so a blocking send could hang the binder
+			this->postman.disconnect(this->entries[i].fd);
+			continue;
+		}
+
+		// clients ignore it
+		this->postman.send_terminate(this->entries[i].fd);
+	}
+
+	this->entries.clear();
+}
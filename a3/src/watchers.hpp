@@ -0,0 +1,55 @@
+#ifndef _watchers_hpp_
+#define _watchers_hpp_
+
+#include "name_service.hpp"
+#include <vector>
+#include <pthread.h>
+
+class Postman;
+
+/*
+	Clients that subscribed (WATCH) to changes of the binder's name directory.
+	Each watcher keeps its WATCH connection open; whenever the directory changes
+	(see NameService::Listener), the reactor pushes the missing log delta as NS_UPDATE_SENT.
+	Pushes never block: a watcher that doesn't read falls behind, and once more than
+	WATCHER_MAX_BACKLOG bytes are waiting for it, it is disconnected. Watchers whose
+	connection has closed are dropped. All public methods are synchronized.
+*/
+class Watchers : public NameService::Listener
+{
+private: // typedefs
+	struct Entry
+	{
+		int fd;
+		unsigned conn_id;
+		unsigned version; // the watcher has (at least) the logs up to this version
+	};
+	typedef std::vector<Entry> Entries;
+
+private: // data
+	Postman &postman;
+	Entries entries;
+	pthread_mutex_t mutex; // also keeps pushes to one watcher in order
+
+private: // methods
+	// sends whatever the watcher is missing; false if the watcher is gone
+	bool push(Entry &entry, unsigned version);
+
+public: // methods
+	Watchers(Postman &postman);
+	~Watchers();
+
+	// version is the one in the header of the WATCH request
+	void add(int fd, unsigned conn_id, unsigned version);
+
+	// wakes the reactor; called with the directory's writer lock held, so it doesn't send
+	virtual void published(NameService &ns);
+
+	// pushes to every watcher that is behind; called by the reactor
+	void push_pending();
+
+	// the binder is terminating; standby binders (which WATCH like clients do) terminate too
+	void terminate();
+};
+
+#endif
@@ -0,0 +1,370 @@
+/*
+ * bench.c
+ *
+ * This file is the end-to-end benchmark client. It forks clients that call
+ * f0~f4 (as registered by server.c) on the servers known to the binder,
+ * then reports the throughput and the latency percentiles.
+ *
+ * Each client is a process since the rpc library keeps one binder
+ * connection and one reply queue per process.
+ *
+ * closed loop: each client sends its next call as soon as the last returns.
+ * open loop (-r): calls are scheduled at a fixed total arrival rate, and the
+ * latency is measured from the scheduled time, so a slow server also counts
+ * the time the call waited behind the previous ones.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "rpc.h"
+
+#define NUM_FUNCS 5
+#define CHAR_ARRAY_LENGTH 100
+#define MAX_ARRAY_LENGTH 0xffff
+
+struct sample {
+  int func;
+  int retval;
+  long latency_us;
+};
+
+struct options {
+  int num_clients;
+  double duration_s;
+  double warmup_s;
+  double rate; /* total calls per second over all clients; 0 for closed loop */
+  int payload; /* bytes in the array of f3 and f4 */
+  int weights[NUM_FUNCS];
+  int is_cache_call;
+};
+
+/* the arguments of one call of each function */
+struct calls {
+  int argTypes[NUM_FUNCS][6];
+  void *args[NUM_FUNCS][5];
+  int a0, b0, r0;
+  char a1; short b1; int c1; long d1, r1;
+  float a2; double b2; char r2[CHAR_ARRAY_LENGTH];
+  long *a3;
+  char *a4; int b4;
+};
+
+static long now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static void sleep_until_us(long t) {
+  long left = t - now_us();
+  if (left > 0) {
+    struct timespec ts;
+    ts.tv_sec = left / 1000000L;
+    ts.tv_nsec = (left % 1000000L) * 1000;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+  }
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+    "usage: %s [-c clients] [-d seconds] [-w warmup seconds] [-r calls/s]\n"
+    "          [-s payload bytes] [-m f0=w,f1=w,f2=w,f3=w,f4=w] [-k]\n"
+    "  -r  open loop at this total arrival rate (default: closed loop)\n"
+    "  -s  size of the f3 (long[]) and f4 (char[]) arrays\n"
+    "  -m  relative weights of the functions (default: f0=1)\n"
+    "  -k  use rpcCacheCall instead of rpcCall\n"
+    "BINDER_ADDRESS and BINDER_PORT must be set.\n", prog);
+  exit(1);
+}
+
+static void parse_mix(const char *mix, int *weights, const char *prog) {
+  char *copy = strdup(mix);
+  char *tok;
+  memset(weights, 0, NUM_FUNCS * sizeof(int));
+  for (tok = strtok(copy, ","); tok != NULL; tok = strtok(NULL, ",")) {
+    int func, weight = 1;
+    if (sscanf(tok, "f%d=%d", &func, &weight) < 1 || func < 0 || func >= NUM_FUNCS || weight < 0)
+      usage(prog);
+    weights[func] = weight;
+  }
+  free(copy);
+}
+
+static void prepare_calls(struct calls *c, int payload) {
+  int num_longs = payload / (int)sizeof(long);
+  int i;
+
+  if (num_longs < 2) num_longs = 2;
+  if (num_longs > MAX_ARRAY_LENGTH) num_longs = MAX_ARRAY_LENGTH;
+  if (payload < 1) payload = 1;
+  if (payload > MAX_ARRAY_LENGTH) payload = MAX_ARRAY_LENGTH;
+
+  c->a0 = 5; c->b0 = 10;
+  c->argTypes[0][0] = (1 << ARG_OUTPUT) | (ARG_INT << 16);
+  c->argTypes[0][1] = (1 << ARG_INPUT) | (ARG_INT << 16);
+  c->argTypes[0][2] = (1 << ARG_INPUT) | (ARG_INT << 16);
+  c->argTypes[0][3] = 0;
+  c->args[0][0] = &c->r0; c->args[0][1] = &c->a0; c->args[0][2] = &c->b0;
+
+  c->a1 = 'a'; c->b1 = 100; c->c1 = 1000; c->d1 = 10000;
+  c->argTypes[1][0] = (1 << ARG_OUTPUT) | (ARG_LONG << 16);
+  c->argTypes[1][1] = (1 << ARG_INPUT) | (ARG_CHAR << 16);
+  c->argTypes[1][2] = (1 << ARG_INPUT) | (ARG_SHORT << 16);
+  c->argTypes[1][3] = (1 << ARG_INPUT) | (ARG_INT << 16);
+  c->argTypes[1][4] = (1 << ARG_INPUT) | (ARG_LONG << 16);
+  c->argTypes[1][5] = 0;
+  c->args[1][0] = &c->r1; c->args[1][1] = &c->a1; c->args[1][2] = &c->b1;
+  c->args[1][3] = &c->c1; c->args[1][4] = &c->d1;
+
+  c->a2 = 3.14159; c->b2 = 1234.1001;
+  c->argTypes[2][0] = (1 << ARG_OUTPUT) | (ARG_CHAR << 16) | CHAR_ARRAY_LENGTH;
+  c->argTypes[2][1] = (1 << ARG_INPUT) | (ARG_FLOAT << 16);
+  c->argTypes[2][2] = (1 << ARG_INPUT) | (ARG_DOUBLE << 16);
+  c->argTypes[2][3] = 0;
+  c->args[2][0] = c->r2; c->args[2][1] = &c->a2; c->args[2][2] = &c->b2;
+
+  /* f3 sorts a[0] elements in decreasing order; this input is already sorted */
+  c->a3 = (long *)malloc(num_longs * sizeof(long));
+  for (i = 0; i < num_longs; i++)
+    c->a3[i] = num_longs - i;
+  c->argTypes[3][0] = (1 << ARG_OUTPUT) | (1 << ARG_INPUT) | (ARG_LONG << 16) | num_longs;
+  c->argTypes[3][1] = 0;
+  c->args[3][0] = c->a3;
+
+  /* the f4 overload that returns 0 */
+  c->a4 = (char *)malloc(payload);
+  memset(c->a4, 'g', payload);
+  c->b4 = 1234;
+  c->argTypes[4][0] = (1 << ARG_INPUT) | (ARG_CHAR << 16) | payload;
+  c->argTypes[4][1] = (1 << ARG_INPUT) | (ARG_INT << 16);
+  c->argTypes[4][2] = 0;
+  c->args[4][0] = c->a4; c->args[4][1] = &c->b4;
+}
+
+static int call(const struct options *opt, struct calls *c, int func) {
+  static const char *names[NUM_FUNCS] = {"f0", "f1", "f2", "f3", "f4"};
+
+  /* f3 sorts in place and a[0] is its length */
+  if (func == 3)
+    c->a3[0] = c->argTypes[3][0] & 0xffff;
+  if (opt->is_cache_call)
+    return rpcCacheCall((char *)names[func], c->argTypes[func], c->args[func]);
+  return rpcCall((char *)names[func], c->argTypes[func], c->args[func]);
+}
+
+static int pick_func(const struct options *opt, int total_weight, unsigned *seed) {
+  int r = rand_r(seed) % total_weight;
+  int func;
+  for (func = 0; r >= opt->weights[func]; func++)
+    r -= opt->weights[func];
+  return func;
+}
+
+/* runs one client and writes its samples to fd */
+static void run_client(const struct options *opt, int id, long start_us, int fd) {
+  struct calls c;
+  unsigned seed = 7919 * (id + 1);
+  long measure_us = start_us + (long)(opt->warmup_s * 1e6);
+  long end_us = measure_us + (long)(opt->duration_s * 1e6);
+  long interval_us = opt->rate > 0 ? (long)(opt->num_clients * 1e6 / opt->rate) : 0;
+  long next_us = start_us + (interval_us * id) / opt->num_clients; /* spread the clients out */
+  size_t num_samples = 0, max_samples = 1024;
+  struct sample *samples = (struct sample *)malloc(max_samples * sizeof(struct sample));
+  int total_weight = 0, i;
+
+  for (i = 0; i < NUM_FUNCS; i++)
+    total_weight += opt->weights[i];
+
+  prepare_calls(&c, opt->payload);
+  sleep_until_us(start_us);
+
+  while (1) {
+    long sent_us, done_us;
+    int func = pick_func(opt, total_weight, &seed);
+    int retval;
+
+    if (interval_us > 0) {
+      if (next_us >= end_us) break;
+      sleep_until_us(next_us);
+      sent_us = next_us;
+      next_us += interval_us;
+    } else {
+      sent_us = now_us();
+      if (sent_us >= end_us) break;
+    }
+
+    retval = call(opt, &c, func);
+    done_us = now_us();
+
+    if (sent_us < measure_us) continue;
+    if (num_samples == max_samples) {
+      max_samples *= 2;
+      samples = (struct sample *)realloc(samples, max_samples * sizeof(struct sample));
+    }
+    samples[num_samples].func = func;
+    samples[num_samples].retval = retval;
+    samples[num_samples].latency_us = done_us - sent_us;
+    num_samples++;
+  }
+
+  {
+    const char *p = (const char *)samples;
+    size_t left = num_samples * sizeof(struct sample);
+    while (left > 0) {
+      ssize_t n = write(fd, p, left);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        perror("write");
+        exit(1);
+      }
+      p += n;
+      left -= n;
+    }
+  }
+  free(samples);
+  free(c.a3);
+  free(c.a4);
+}
+
+static int compare_long(const void *a, const void *b) {
+  long x = *(const long *)a, y = *(const long *)b;
+  return x < y ? -1 : x > y;
+}
+
+static long percentile(const long *sorted, size_t n, double p) {
+  size_t i = (size_t)(p * n);
+  if (n == 0) return 0;
+  return sorted[i < n ? i : n - 1];
+}
+
+static void report(const char *label, const struct sample *samples, size_t n, int func, double duration_s) {
+  long *latencies = (long *)malloc((n + 1) * sizeof(long));
+  size_t m = 0, errors = 0, i;
+
+  for (i = 0; i < n; i++) {
+    if (func >= 0 && samples[i].func != func) continue;
+    if (samples[i].retval < 0) errors++;
+    latencies[m++] = samples[i].latency_us;
+  }
+  if (m > 0 || func < 0) {
+    qsort(latencies, m, sizeof(long), &compare_long);
+    printf("%-6s %9lu %7lu %11.1f %8ld %8ld %8ld %8ld\n", label,
+      (unsigned long)m, (unsigned long)errors, m / duration_s,
+      percentile(latencies, m, 0.5), percentile(latencies, m, 0.99),
+      percentile(latencies, m, 0.999), m > 0 ? latencies[m - 1] : 0);
+  }
+  free(latencies);
+}
+
+int main(int argc, char **argv) {
+  struct options opt;
+  struct sample *samples = NULL;
+  size_t num_samples = 0;
+  int *fds;
+  pid_t *pids;
+  long start_us;
+  int i, opt_char, total_weight = 0;
+
+  memset(&opt, 0, sizeof(opt));
+  opt.num_clients = 1;
+  opt.duration_s = 5;
+  opt.warmup_s = 1;
+  opt.payload = 100;
+  opt.weights[0] = 1;
+
+  while ((opt_char = getopt(argc, argv, "c:d:w:r:s:m:k")) != -1) {
+    switch (opt_char) {
+    case 'c': opt.num_clients = atoi(optarg); break;
+    case 'd': opt.duration_s = atof(optarg); break;
+    case 'w': opt.warmup_s = atof(optarg); break;
+    case 'r': opt.rate = atof(optarg); break;
+    case 's': opt.payload = atoi(optarg); break;
+    case 'm': parse_mix(optarg, opt.weights, argv[0]); break;
+    case 'k': opt.is_cache_call = 1; break;
+    default: usage(argv[0]);
+    }
+  }
+  for (i = 0; i < NUM_FUNCS; i++)
+    total_weight += opt.weights[i];
+  if (opt.num_clients < 1 || opt.duration_s <= 0 || opt.warmup_s < 0 || opt.rate < 0 || total_weight == 0)
+    usage(argv[0]);
+
+  fds = (int *)malloc(opt.num_clients * sizeof(int));
+  pids = (pid_t *)malloc(opt.num_clients * sizeof(pid_t));
+  /* leave the clients time to start */
+  start_us = now_us() + 200000 + 2000L * opt.num_clients;
+
+  for (i = 0; i < opt.num_clients; i++) {
+    int p[2];
+    if (pipe(p) < 0) {
+      perror("pipe");
+      return 1;
+    }
+    pids[i] = fork();
+    if (pids[i] < 0) {
+      perror("fork");
+      return 1;
+    }
+    if (pids[i] == 0) {
+      close(p[0]);
+      run_client(&opt, i, start_us, p[1]);
+      close(p[1]);
+      _exit(0);
+    }
+    close(p[1]);
+    fds[i] = p[0];
+  }
+
+  /* read before waiting, since a client blocks until its samples fit in the pipe */
+  for (i = 0; i < opt.num_clients; i++) {
+    size_t size = 0, cap = 0;
+    char *buf = NULL;
+    while (1) {
+      ssize_t n;
+      if (size == cap) {
+        cap = cap ? cap * 2 : 64 * 1024;
+        buf = (char *)realloc(buf, cap);
+      }
+      n = read(fds[i], buf + size, cap - size);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) break;
+      size += n;
+    }
+    close(fds[i]);
+    samples = (struct sample *)realloc(samples, (num_samples + size / sizeof(struct sample) + 1) * sizeof(struct sample));
+    memcpy(samples + num_samples, buf, size - size % sizeof(struct sample));
+    num_samples += size / sizeof(struct sample);
+    free(buf);
+  }
+  for (i = 0; i < opt.num_clients; i++) {
+    int status;
+    waitpid(pids[i], &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      fprintf(stderr, "client %d failed\n", i);
+  }
+
+  printf("clients %d, %s", opt.num_clients, opt.rate > 0 ? "open loop" : "closed loop");
+  if (opt.rate > 0) printf(" at %.1f calls/s", opt.rate);
+  printf(", %.1fs (+%.1fs warmup), payload %d bytes, %s, mix",
+    opt.duration_s, opt.warmup_s, opt.payload, opt.is_cache_call ? "rpcCacheCall" : "rpcCall");
+  for (i = 0; i < NUM_FUNCS; i++)
+    if (opt.weights[i] > 0) printf(" f%d=%d", i, opt.weights[i]);
+  printf("\n%-6s %9s %7s %11s %8s %8s %8s %8s\n", "func", "calls", "errors", "calls/s", "p50(us)", "p99(us)", "p999(us)", "max(us)");
+  for (i = 0; i < NUM_FUNCS; i++) {
+    char label[8];
+    sprintf(label, "f%d", i);
+    report(label, samples, num_samples, i, opt.duration_s);
+  }
+  report("total", samples, num_samples, -1, opt.duration_s);
+
+  free(samples);
+  free(fds);
+  free(pids);
+  return 0;
+}
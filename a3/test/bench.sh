@@ -0,0 +1,30 @@
+#!/bin/bash
+# starts a binder and N servers on localhost, runs ./bench against them, then stops them
+# usage: ./bench.sh [num_servers] [bench options]
+# build with "make" in a3 (asserts and debug prints off) and "make" here first
+
+NUM_SERVERS=${1:-1}
+shift
+
+LOG=$(mktemp -d)
+trap 'kill $PIDS 2>/dev/null; wait 2>/dev/null; rm -rf $LOG' EXIT
+
+../binder > $LOG/binder.out 2>&1 &
+PIDS=$!
+for i in $(seq 50); do
+	grep -q BINDER_PORT $LOG/binder.out && break
+	sleep 0.1
+done
+BINDER_ADDRESS=$(awk '/BINDER_ADDRESS/{print $2}' $LOG/binder.out | head -1)
+BINDER_PORT=$(awk '/BINDER_PORT/{print $2}' $LOG/binder.out | head -1)
+export BINDER_ADDRESS
+export BINDER_PORT
+
+for i in $(seq $NUM_SERVERS); do
+	./server > /dev/null 2>&1 &
+	PIDS="$PIDS $!"
+done
+# let the servers register
+sleep 1
+
+./bench "$@"
@@ -0,0 +1,62 @@
+#!/bin/bash
+# starts a primary binder, a standby that watches it, and a server on localhost; runs client1,
+# kills the primary, and runs client1 again against the standby
+# usage: ./failover.sh
+# build with "make" in a3 and "make" here first; exits with 1 if a client call failed
+
+LOG=$(mktemp -d)
+trap 'kill $PIDS 2>/dev/null; wait 2>/dev/null; rm -rf $LOG' EXIT
+
+# waits for a binder to print its port to $1
+wait_for_port() {
+	for i in $(seq 50); do
+		grep -q BINDER_PORT $1 && break
+		sleep 0.1
+	done
+}
+
+../binder > $LOG/primary.out 2>&1 &
+PRIMARY_PID=$!
+PIDS=$PRIMARY_PID
+wait_for_port $LOG/primary.out
+ADDRESS=$(awk '/BINDER_ADDRESS/{print $2}' $LOG/primary.out | head -1)
+PRIMARY_PORT=$(awk '/BINDER_PORT/{print $2}' $LOG/primary.out | head -1)
+
+BINDER_PRIMARY_ADDRESS=$ADDRESS BINDER_PRIMARY_PORT=$PRIMARY_PORT ../binder > $LOG/standby.out 2>&1 &
+PIDS="$PIDS $!"
+wait_for_port $LOG/standby.out
+STANDBY_PORT=$(awk '/BINDER_PORT/{print $2}' $LOG/standby.out | head -1)
+
+# the primary first, then the standby
+BINDER_ADDRESS=$ADDRESS,$ADDRESS
+BINDER_PORT=$PRIMARY_PORT,$STANDBY_PORT
+export BINDER_ADDRESS
+export BINDER_PORT
+
+./server > /dev/null 2>&1 &
+PIDS="$PIDS $!"
+# let the server register, and the standby get the pushes
+sleep 1
+
+# every call must return; f4's return is an error by design (it prints a file that doesn't exist)
+run_client() {
+	echo n | timeout 30 ./client1 > $LOG/client_$1.out 2>&1
+	NUM_OK=$(grep -c ACTUAL $LOG/client_$1.out)
+	echo "$1: $NUM_OK calls returned"
+	[ "$NUM_OK" -eq 5 ] && ! grep -q Error $LOG/client_$1.out
+}
+
+STATUS=0
+run_client primary || STATUS=1
+kill $PRIMARY_PID
+wait $PRIMARY_PID 2>/dev/null
+run_client standby || STATUS=1
+
+if [ $STATUS -eq 0 ]; then
+	echo "failover passed"
+else
+	echo "failover FAILED; logs:"
+	cat $LOG/*.out
+fi
+
+exit $STATUS
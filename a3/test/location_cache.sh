@@ -0,0 +1,64 @@
+#!/bin/bash
+# starts a binder and 2 servers on localhost, and has one client call f0 over and over for a second;
+# with the location cache on (the default RPC_LOCATION_TTL), the client must ask the binder only
+# once in a while, and still spread the calls over both servers
+# usage: ./location_cache.sh
+# build with "make" in a3 and "make" here first; exits with 1 if the check fails
+
+LOG=$(mktemp -d)
+trap 'kill $PIDS 2>/dev/null; wait 2>/dev/null; rm -rf $LOG' EXIT
+
+../binder > $LOG/binder.out 2>&1 &
+PIDS=$!
+for i in $(seq 50); do
+	grep -q BINDER_PORT $LOG/binder.out && break
+	sleep 0.1
+done
+BINDER_ADDRESS=$(awk '/BINDER_ADDRESS/{print $2}' $LOG/binder.out | head -1)
+BINDER_PORT=$(awk '/BINDER_PORT/{print $2}' $LOG/binder.out | head -1)
+export BINDER_ADDRESS
+export BINDER_PORT
+
+SERVER_PIDS=""
+for i in 1 2; do
+	./server > /dev/null 2>&1 &
+	SERVER_PIDS="$SERVER_PIDS $!"
+done
+PIDS="$PIDS $SERVER_PIDS"
+# let the servers register
+sleep 1
+
+./bench -c 1 -d 1 -w 0 -m f0=1 > $LOG/bench.out 2>&1
+NUM_CALLS=$(awk '$1 == "total" {print $2}' $LOG/bench.out)
+
+# the "in" column of a message type in rpcstat's table
+count_in() {
+	../rpcstat "$@" | awk -v type=$TYPE '$1 == type {print $2}' | head -1
+}
+
+TYPE=LOC_REQUEST
+NUM_LOC_REQUESTS=$(count_in)
+NUM_LOC_REQUESTS=${NUM_LOC_REQUESTS:-0}
+echo "$NUM_CALLS calls, $NUM_LOC_REQUESTS LOC_REQUESTs"
+
+STATUS=0
+[ -n "$NUM_CALLS" ] && [ "$NUM_CALLS" -ge 20 ] && [ $((NUM_LOC_REQUESTS * 10)) -le "$NUM_CALLS" ] || STATUS=1
+
+# every server must get at least a quarter of the calls
+TYPE=EXECUTE
+for pid in $SERVER_PIDS; do
+	PORT=$(ss -ltnpH | awk -v pid="pid=$pid," 'index($0, pid) {n = split($4, a, ":"); print a[n]}' | head -1)
+	NUM_EXECUTES=$(count_in $BINDER_ADDRESS $PORT)
+	NUM_EXECUTES=${NUM_EXECUTES:-0}
+	echo "server $PORT: $NUM_EXECUTES calls"
+	[ $((NUM_EXECUTES * 4)) -ge "${NUM_CALLS:-1}" ] || STATUS=1
+done
+
+if [ $STATUS -eq 0 ]; then
+	echo "location cache passed"
+else
+	echo "location cache FAILED; logs:"
+	cat $LOG/*.out
+fi
+
+exit $STATUS
@@ -0,0 +1,209 @@
+#include "common.hpp"
+#include "name_service.hpp"
+#include "rpc.h"
+#include <cstdlib>
+#include <cstring>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+// Measures the marshaling layer without sockets: push_args/pop_args (the bodies of
+// EXECUTE and EXECUTE_REPLY) per argument type and cardinality, and push(Function)/
+// func_from_sstream. Every case checks that decoding gives back what was encoded.
+// The output is CSV on stdout, one line per case, so runs can be diffed or joined.
+
+static const int data_types[] = {ARG_CHAR, ARG_SHORT, ARG_INT, ARG_LONG, ARG_DOUBLE, ARG_FLOAT};
+static const char *data_type_names[] = {"", "char", "short", "int", "long", "double", "float"};
+static const int cardinalities[] = {0, 1, 16, 256, 4096, 65535};
+
+static double now_s()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// bytes that exercise sign extension and byte order, without NaNs
+static void fill(char *buf, size_t size, int data_type)
+{
+	for(size_t i = 0; i < size; i++)
+	{
+		buf[i] = static_cast<char>(i * 131 + 7);
+	}
+
+	if(data_type == ARG_DOUBLE || data_type == ARG_FLOAT)
+	{
+		size_t elem_size = data_type == ARG_DOUBLE ? sizeof(double) : sizeof(float);
+
+		for(size_t i = 0; i < size / elem_size; i++)
+		{
+			if(data_type == ARG_DOUBLE)
+			{
+				((double*)buf)[i] = (i % 2 ? -1.0 : 1.0) * i / 3.0;
+			}
+			else
+			{
+				((float*)buf)[i] = (i % 2 ? -1.0f : 1.0f) * i / 3.0f;
+			}
+		}
+	}
+}
+
+static void print_result(const char *op, const char *type, int cardinality, size_t bytes,
+                         size_t elements, long iterations, double elapsed, bool is_ok)
+{
+	double ns_per_op = elapsed * 1e9 / iterations;
+	printf("%s,%s,%d,%lu,%ld,%.1f,%.3f,%.1f,%d\n", op, type, cardinality,
+	       (unsigned long)bytes, iterations, ns_per_op, ns_per_op / elements,
+	       bytes * iterations / elapsed / 1e6, is_ok ? 1 : 0);
+	fflush(stdout);
+}
+
+// one INOUT argument of data_type; returns false if the round trip doesn't match
+static bool bench_args(int data_type, int cardinality, double min_time)
+{
+	Function func;
+	func.name = "f";
+	func.types.push_back((1 << ARG_INPUT) | (1 << ARG_OUTPUT) | (data_type << 16) | cardinality);
+	size_t size = get_arg_size(func.types[0]);
+	size_t elements = get_arg_car(func.types[0]);
+	char *in = static_cast<char*>(malloc(size));
+	char *out = static_cast<char*>(malloc(size));
+	void *in_args[1] = {in};
+	void *out_args[1] = {out};
+	fill(in, size, data_type);
+
+	std::string encoded;
+	long iterations = 0;
+	double start = now_s(), elapsed;
+
+	do
+	{
+		for(int i = 0; i < 16; i++)
+		{
+			std::stringstream ss;
+			push_args(ss, func, in_args, false);
+			encoded = ss.str();
+		}
+
+		iterations += 16;
+		elapsed = now_s() - start;
+	}
+	while(elapsed < min_time);
+
+	print_result("encode", data_type_names[data_type], cardinality, encoded.size(), elements, iterations, elapsed, true);
+
+	iterations = 0;
+	start = now_s();
+
+	do
+	{
+		for(int i = 0; i < 16; i++)
+		{
+			std::stringstream ss(encoded);
+			pop_args(ss, func, out_args, true);
+		}
+
+		iterations += 16;
+		elapsed = now_s() - start;
+	}
+	while(elapsed < min_time);
+
+	bool is_ok = memcmp(in, out, size) == 0;
+	print_result("decode", data_type_names[data_type], cardinality, encoded.size(), elements, iterations, elapsed, is_ok);
+
+	free(in);
+	free(out);
+	return is_ok;
+}
+
+// a signature of num_args int scalars, as sent by LOC_REQUEST, REGISTER and EXECUTE
+static bool bench_function(int num_args, double min_time)
+{
+	Function func;
+	func.name = "some_function";
+
+	for(int i = 0; i < num_args; i++)
+	{
+		func.types.push_back((1 << ARG_INPUT) | (ARG_INT << 16));
+	}
+
+	std::string encoded;
+	long iterations = 0;
+	double start = now_s(), elapsed;
+
+	do
+	{
+		for(int i = 0; i < 16; i++)
+		{
+			std::stringstream ss;
+			push(ss, func);
+			encoded = ss.str();
+		}
+
+		iterations += 16;
+		elapsed = now_s() - start;
+	}
+	while(elapsed < min_time);
+
+	print_result("encode", "function", num_args, encoded.size(), num_args + 1, iterations, elapsed, true);
+
+	Function decoded;
+	iterations = 0;
+	start = now_s();
+
+	do
+	{
+		for(int i = 0; i < 16; i++)
+		{
+			std::stringstream ss(encoded);
+			decoded = func_from_sstream(ss);
+		}
+
+		iterations += 16;
+		elapsed = now_s() - start;
+	}
+	while(elapsed < min_time);
+
+	bool is_ok = decoded.name == func.name && decoded.types == func.types;
+	print_result("decode", "function", num_args, encoded.size(), num_args + 1, iterations, elapsed, is_ok);
+	return is_ok;
+}
+
+int main(int argc, char **argv)
+{
+	double min_time = 0.2;
+	int opt;
+
+	while((opt = getopt(argc, argv, "t:")) != -1)
+	{
+		if(opt != 't' || (min_time = atof(optarg)) <= 0)
+		{
+			fprintf(stderr, "usage: %s [-t seconds per case]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	bool is_ok = true;
+	// cardinality is 0 for scalars; elements counts the array elements (or the arguments plus the name)
+	printf("op,type,cardinality,bytes,iterations,ns_per_op,ns_per_element,mb_per_s,ok\n");
+
+	for(size_t i = 0; i < sizeof(data_types) / sizeof(data_types[0]); i++)
+	{
+		for(size_t j = 0; j < sizeof(cardinalities) / sizeof(cardinalities[0]); j++)
+		{
+			is_ok = bench_args(data_types[i], cardinalities[j], min_time) && is_ok;
+		}
+	}
+
+	is_ok = bench_function(1, min_time) && is_ok;
+	is_ok = bench_function(16, min_time) && is_ok;
+
+	if(!is_ok)
+	{
+		fprintf(stderr, "round trip failed\n");
+		return 1;
+	}
+
+	return 0;
+}
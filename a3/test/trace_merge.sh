@@ -0,0 +1,13 @@
+#!/bin/bash
+# merges the trace files of several processes (RPC_TRACE_FILE) into one for chrome://tracing or Perfetto
+# usage: ./trace_merge.sh /tmp/trace.*.json > all.json
+
+echo '['
+SEP=''
+for f in "$@"; do
+	echo -n "$SEP"
+	# each file is "[event" then ",\nevent" lines, and "]" only if the process exited normally
+	sed -e '1s/^\[//' -e '/^\]$/d' "$f"
+	SEP=','
+done
+echo ']'
@@ -0,0 +1,59 @@
+/*
+ * watch_client.c
+ * 
+ * This file is the client program for rpcWatch,
+ * which has the binder push directory changes to the local cache,
+ * calls "rpcCacheCall", and checks the returns.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rpc.h"
+
+int main() {
+
+  /* prepare the arguments for f0 */
+  int a0 = 5;
+  int b0 = 10;
+  int count0 = 3;
+  int return0;
+  int argTypes0[count0 + 1];
+  void **args0;
+
+  argTypes0[0] = (1 << ARG_OUTPUT) | (ARG_INT << 16);
+  argTypes0[1] = (1 << ARG_INPUT) | (ARG_INT << 16);
+  argTypes0[2] = (1 << ARG_INPUT) | (ARG_INT << 16);
+  argTypes0[3] = 0;
+    
+  args0 = (void **)malloc(count0 * sizeof(void *));
+  args0[0] = (void *)&return0;
+  args0[1] = (void *)&a0;
+  args0[2] = (void *)&b0;
+
+  /* have the binder push directory changes to the local cache */
+  int sw = rpcWatch();
+  assert(sw >= 0);
+  printf("rpcWatch: %d\n", sw);
+
+  /* rpcCacheCalls, served from the pushed directory */
+  int i;
+  for (i = 0; i < 5; i++) {
+    return0 = 0;
+    int s0 = rpcCacheCall("f0", argTypes0, args0);
+    /* test the return f0 */
+    printf("\nEXPECTED return of f0 is: %d\n", a0 + b0);
+    if (s0 >= 0) { 
+      printf("ACTUAL return of f0 is: %d\n", *((int *)(args0[0])));
+    }
+    else {
+      printf("Error: %d\n", s0);
+    }
+  }
+
+  free(args0);
+
+  /* end of watch_client.c */
+  return 0;
+}